@@ -0,0 +1,85 @@
+#include "aliastable.h"
+
+AliasTable::AliasTable()
+{
+}
+
+void AliasTable::build(const Array<float> &weights)
+{
+    clear();
+
+    int n = weights.size();
+    if (n == 0) {
+        return;
+    }
+
+    double total = 0.0;
+    for (int i = 0; i < n; ++i) {
+        total += weights[i];
+    }
+
+    m_pdf.resize(n);
+    m_threshold.resize(n);
+    m_alias.resize(n);
+
+    // Scale the weights so the average column holds exactly 1
+    Array<double> scaled;
+    scaled.resize(n);
+    for (int i = 0; i < n; ++i) {
+        m_pdf[i] = (total > 0.0) ? float(weights[i] / total) : 1.f / n;
+        scaled[i] = (total > 0.0) ? weights[i] * n / total : 1.0;
+    }
+
+    Array<int> small;
+    Array<int> large;
+    for (int i = 0; i < n; ++i) {
+        if (scaled[i] < 1.0) {
+            small.append(i);
+        } else {
+            large.append(i);
+        }
+    }
+
+    // Fill each under-full column with the remainder of an over-full one
+    while (small.size() > 0 && large.size() > 0) {
+        int s = small.pop();
+        int l = large.pop();
+
+        m_threshold[s] = float(scaled[s]);
+        m_alias[s] = l;
+
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) {
+            small.append(l);
+        } else {
+            large.append(l);
+        }
+    }
+
+    // Whatever is left is full, up to rounding
+    while (large.size() > 0) {
+        int l = large.pop();
+        m_threshold[l] = 1.f;
+        m_alias[l] = l;
+    }
+    while (small.size() > 0) {
+        int s = small.pop();
+        m_threshold[s] = 1.f;
+        m_alias[s] = s;
+    }
+}
+
+void AliasTable::clear()
+{
+    m_threshold.fastClear();
+    m_alias.fastClear();
+    m_pdf.fastClear();
+}
+
+int AliasTable::sample(Random &random) const
+{
+    // The integer part picks the column, the fraction decides between it and its alias
+    float u = random.uniform() * m_threshold.size();
+    int i = min(int(u), m_threshold.size() - 1);
+    return (u - i < m_threshold[i]) ? i : m_alias[i];
+}
@@ -0,0 +1,32 @@
+#ifndef ALIASTABLE_H
+#define ALIASTABLE_H
+#include <G3D/G3DAll.h>
+
+/** Samples an index in constant time from a discrete distribution
+  * (Walker's alias method, built with Vose's algorithm).
+  */
+class AliasTable
+{
+public:
+    AliasTable();
+
+    /** Builds the table. Weights need not be normalized but must not be negative. */
+    void build(const Array<float> &weights);
+
+    void clear();
+
+    /** Picks an index with probability proportional to its weight, using one random number */
+    int sample(Random &random) const;
+
+    /** The probability that sample() returns index i */
+    float probability(int i) const { return m_pdf[i]; }
+
+    int size() const { return m_pdf.size(); }
+
+private:
+    Array<float>    m_threshold; // chance of keeping column i rather than taking its alias
+    Array<int>      m_alias;
+    Array<float>    m_pdf;
+};
+
+#endif // ALIASTABLE_H
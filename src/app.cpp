@@ -1,11 +1,9 @@
 #include "app.h"
+#include "renderstats.h"
 
 #ifndef G3D_PATH
 #define G3D_PATH "/contrib/projects/g3d10/G3D10"
 #endif
-#define THREADS 8
-
-static Random &rng = Random::common();
 
 String App::m_scenePath = G3D_PATH "/data/scene";
 String App::m_defaultScene = FileSystem::currentDirectory() + "/../data-files/scene/sphere_spline.Scene.Any";
@@ -19,30 +17,11 @@ App::App(const GApp::Settings &settings)
       m_passType(0),
       m_radius(1),
       num_passes(5000),
-      m_maxPasses(20)
+      m_maxPasses(20),
+      m_canvasVersion(0),
+      m_evenFrame(false)
 {
     m_scenePath = FileSystem::currentDirectory() + "/scene";
-
-    m_PSettings->attenuation=0.0; // variable in transmission calculation
-    m_PSettings->scattering=0.0; // ratio of scattering to extinction
-
-    m_PSettings->noiseBiasRatio=0.0;
-    m_PSettings->radiusScalingFactor=0.95;
-
-    m_PSettings->maxDepthScatter=100;
-    m_PSettings->maxDepthRender=3;
-    m_PSettings->epsilon=0.0001;
-    m_PSettings->numBeamettesDir=10;
-    m_PSettings->numBeamettesInDir=2000;
-
-    m_PSettings->directSamples=64;
-
-    m_PSettings->gatherRadius=0.5;
-    m_PSettings->useFinalGather=false;
-    m_PSettings->gatherSamples=50;
-    m_PSettings->dist = .5;
-    m_PSettings->beamIntensity = 1;
-    m_PSettings->beamSpread = 1;
 }
 
 App::~App() { }
@@ -56,24 +35,36 @@ void App::buildPhotonMap(bool createRngGen)
 {
     if (createRngGen) {
         // Make the direct photon beams, to be splatted and rendered directly.
+        // The GUI thread takes the batches from the worker, see onGraphics3D()
         m_dirBeams = std::make_unique<DirPhotonScatter>(&m_world, m_PSettings);
-        m_dirBeams->makeBeams();
+        m_dirBeams->startWorker(m_radius);
 
         // Make the indirect photon beams, to be used to evaluate the lighting equation in the scene.
         // Note that it's redundant to here calculate both of these lighting maps, but
         // we'll later be using them at different rates (and also with different scattering properties)
         m_inDirBeams = std::make_unique<IndPhotonScatter>(&m_world, m_PSettings);
+        // Passes count from 0 here, the seeds from 1. A resumed render
+        // scatters from other seeds than the passes it already has.
+        m_inDirBeams->reseed(indRenderCount + 2);
         m_inDirBeams->makeBeams();
 
         // Create renderer
         m_indRenderer = std::make_unique<IndRenderer>(&m_world, m_PSettings);
         m_indRenderer->setBeams(m_inDirBeams->getBeams());
     } else {
-        m_inDirBeams->makeBeams();
-        m_indRenderer->setBeams(m_inDirBeams->getBeams());
+        // Into the back buffer, in the background, see swapPhotonMap()
+        m_inDirBeams->startRefresh();
     }
 }
 
+void App::swapPhotonMap()
+{
+    m_inDirBeams->waitRefresh();
+    STATS_STAGE(STAGE_SCATTER, m_inDirBeams->refreshTime());
+    m_inDirBeams->swapBeams();
+    m_indRenderer->setBeams(m_inDirBeams->getBeams());
+}
+
 void App::traceCallback(int x, int y)
 {
 
@@ -82,16 +73,19 @@ void App::traceCallback(int x, int y)
         m_canvas->set(x, y, Radiance3::black());
     } else {
 
+        // Each pixel sample draws from its own stream, see SampleContext
+        SampleContext ctx(x, y, indRenderCount, m_PSettings->renderSeed);
+
         // TODO : keep random or just use .5f?
-        double dx = rng.uniform(), dy = rng.uniform();
+        double dx = ctx.random.uniform(), dy = ctx.random.uniform();
 
         // Choose a ray, shoot it into the scean
         Ray ray = m_world.camera()->worldRay(x + dx, y + dy, m_canvas->rect2DBounds());
         if (indRenderCount == 0) {
-            m_canvas->set(x, y, m_indRenderer->trace(ray, m_PSettings->maxDepthScatter));
+            m_canvas->set(x, y, m_indRenderer->trace(ray, m_PSettings->maxDepthScatter, ctx));
         } else {
             Radiance3 prev = m_canvas->get(x,y);
-            Radiance3 sample = m_indRenderer->trace(ray, m_PSettings->maxDepthScatter);
+            Radiance3 sample = m_indRenderer->trace(ray, m_PSettings->maxDepthScatter, ctx);
 
             float indCountFl = static_cast<float>(indRenderCount);
 
@@ -108,25 +102,83 @@ static void dispatcher(void *arg)
 {
     App *self = (App*)arg;
     self->stage = App::SCATTERING;
+    bool checkpointing = !self->checkpointFile().empty();
+    if (checkpointing) {
+        self->resumeCheckpoint();
+    }
+
+    RealTime scatterStart = System::time();
     self->buildPhotonMap(true);
+    STATS_STAGE(STAGE_SCATTER, System::time() - scatterStart);
 
     // Create the thread pool and for each pass, send out THREADs number of threads to do the dirty work.
-    ThreadPool pool( self, THREADS );
+    shared_ptr<PhotonSettings> settings = self->photonSettings();
+    ThreadPool pool( [self](int x, int y) { self->traceCallback(x, y); },
+                     settings->numRenderThreads, settings->renderAffinity );
     while (self->indRenderCount < self->m_maxPasses && self->continueRender) {
         printf("Rendering ...");
         std::cout << " Pass: " << self->indRenderCount << std::endl;
         fflush(stdout);
-        self->buildPhotonMap(false);
         self->indRenderCount += 1;
 
         if (self->prevIndRenderCount != -1) {
             self->prevIndRenderCount += 1;
         }
 
+        // Sizes the grid of the current map, so do it before the
+        // background scatter may start copying that map.
+        RealTime indexStart = System::time();
         self->setGatherRadius();
+        STATS_STAGE(STAGE_INDEX, System::time() - indexStart);
+
+        // Scatter the next pass's beams while this pass gathers from the current ones
+        bool scattering = self->indRenderCount < self->m_maxPasses;
+        if (scattering) {
+            self->buildPhotonMap(false);
+        }
+
+        // Stopping mid-pass leaves the canvas half updated, so keep the
+        // canvas from before the pass to checkpoint instead
+        shared_ptr<Image3> before;
+        if (checkpointing) {
+            before = self->canvasSnapshot();
+        }
+
         self->stage = App::GATHERING;
-        pool.run();
-        printf("done\n");
+        pool.run(self->window()->width(), self->window()->height());
+
+        // Time the gather waits on the scatter, i.e. the part not hidden
+        RealTime waitStart = System::time();
+        if (scattering) {
+            self->swapPhotonMap();
+        }
+        RealTime scatterWait = System::time() - waitStart;
+
+        double idle = 0.0, maxIdle = 0.0;
+        for (int i = 0; i < pool.idleTimes().size(); ++i) {
+            idle += pool.idleTimes()[i];
+            maxIdle = max(maxIdle, pool.idleTimes()[i]);
+        }
+        idle /= pool.idleTimes().size();
+        printf("done in %.1f ms (threads idle %.1f ms on average, %.1f ms at most, %.1f ms waiting on the scatter)\n",
+               pool.passTime() * 1000.0, idle * 1000.0, maxIdle * 1000.0, scatterWait * 1000.0);
+        self->printGatherStats();
+
+        STATS_STAGE(STAGE_GATHER, pool.passTime());
+        STATS_STAGE(STAGE_SCATTER_WAIT, scatterWait);
+        STATS_END_PASS(self->indRenderCount);
+        self->canvasChanged();
+
+        if (checkpointing)
+        {
+            int interval = settings->checkpointInterval;
+            if (!self->continueRender) {
+                self->saveCheckpoint(before, self->indRenderCount - 1);
+            } else if (self->indRenderCount == self->m_maxPasses ||
+                       (interval > 0 && (self->indRenderCount + 1) % interval == 0)) {
+                self->saveCheckpoint(self->canvasSnapshot(), self->indRenderCount);
+            }
+        }
     }
     self->stage = App::IDLE;
 }
@@ -139,11 +191,7 @@ void App::onInit()
     // GPU stuff
 
     m_passes = 0;
-    m_dirLight = Texture::createEmpty("App::dirLight", m_framebuffer->width(),
-                                      m_framebuffer->height(), ImageFormat::RGBA16());
-
-    m_zBuffer = Texture::createEmpty("App::zBuffer", m_framebuffer->width(),
-                                      m_framebuffer->height(), ImageFormat::R16());
+    m_splatPass = std::make_unique<SplatPass>(m_framebuffer->width(), m_framebuffer->height());
 
     m_totalDirLight1 = Texture::createEmpty("App::totalDirLight1", m_framebuffer->width(),
                                           m_framebuffer->height(), ImageFormat::RGBA16());
@@ -157,21 +205,14 @@ void App::onInit()
     m_currentComposite2 = Texture::createEmpty("App::currentComp2", m_framebuffer->width(),
                                          m_framebuffer->height(), ImageFormat::RGBA16());
 
-    m_dirLight->clear();
-    m_zBuffer->clear();
     m_totalDirLight1->clear();
     m_currentComposite1->clear();
     m_totalDirLight2->clear();
     m_currentComposite2->clear();
 
-    m_dirFBO = Framebuffer::create(m_dirLight);
-    m_ZFBO = Framebuffer::create(m_zBuffer);
     m_FBO1 = Framebuffer::create(m_currentComposite1);
     m_FBO2 = Framebuffer::create(m_currentComposite2);
 
-    m_ZFBO->set(Framebuffer::AttachmentPoint::COLOR1, m_zBuffer);
-    m_dirFBO->set(Framebuffer::AttachmentPoint::COLOR1, m_dirLight);
-    m_dirFBO->set(Framebuffer::AttachmentPoint::COLOR1, m_dirLight);
     m_FBO1->set(Framebuffer::AttachmentPoint::COLOR1, m_currentComposite1);
     m_FBO1->set(Framebuffer::AttachmentPoint::COLOR2, m_totalDirLight1);
     m_FBO2->set(Framebuffer::AttachmentPoint::COLOR1, m_currentComposite2);
@@ -202,6 +243,7 @@ void App::onInit()
 
     m_canvas = Image3::createEmpty(window()->width(),
                                    window()->height());
+    canvasChanged();
     developerWindow->setResizable(true);
 }
 
@@ -303,14 +345,21 @@ void App::onRender()
         indRenderCount = -1;
         prevIndRenderCount = -1;
         String fullpath = m_scenePath + "/" + m_ddl->selectedValue().text();
+        m_sceneFile = fullpath;
 
+        // The direct scatter worker reads the world
+        if (m_dirBeams) {
+            m_dirBeams->stopWorker();
+        }
         m_world.unload();
         m_world.setSettings(m_PSettings);
+        m_world.setCacheDirectory(m_sceneCache);
         m_world.load(fullpath);
 
         std::cout << "Loading scene path " + fullpath << std::endl;
         m_canvas = Image3::createEmpty(window()->width(),
                                        window()->height());
+        canvasChanged();
         m_dispatch = Thread::create("dispatcher", dispatcher, this);
         m_dispatch->start();
     } else {
@@ -318,8 +367,94 @@ void App::onRender()
     }
 }
 
+void App::printGatherStats()
+{
+    // Nothing is counted without ILLUMINATI_STATS, so this prints nothing
+    BeamQueryStats total = IndRenderer::gatherTotals();
+    BeamQueryStats stats = total.since(m_gatherReported);
+    m_gatherReported = total;
+
+    if (stats.queries == 0 || stats.beamsTested == 0) {
+        return;
+    }
+
+    printf("Gather: %.1f nodes visited, %.1f beams tested per query, %.1f%% false positives\n",
+           double(stats.nodesVisited) / stats.queries,
+           double(stats.beamsTested) / stats.queries,
+           100.0 * double(stats.beamsTested - stats.beamsHit) / stats.beamsTested);
+}
+
+void App::resumeCheckpoint()
+{
+    Checkpoint checkpoint;
+    if (!checkpoint.load(m_checkpointFile) ||
+        !checkpoint.matches(m_sceneFile, m_canvas->width(), m_canvas->height(), *m_PSettings)) {
+        return;
+    }
+
+    // This app renders passes 0, 1, 2, ... without gaps
+    if (checkpoint.passes.size() == 0 || checkpoint.passes.last() != checkpoint.passes.size() - 1) {
+        printf("%s is not of an app render\n", m_checkpointFile.c_str());
+        return;
+    }
+
+    m_canvas = checkpoint.image;
+    canvasChanged();
+    indRenderCount = checkpoint.passes.last();
+    printf("Resuming from %s after %d passes\n", m_checkpointFile.c_str(), checkpoint.passes.size());
+}
+
+void App::saveCheckpoint(shared_ptr<Image3> image, int lastPass)
+{
+    if (lastPass < 0) {
+        return;
+    }
+
+    Checkpoint checkpoint;
+    checkpoint.scene = m_sceneFile;
+    for (int pass = 0; pass <= lastPass; ++pass)
+    {
+        checkpoint.passes.append(pass);
+    }
+    checkpoint.gatherRadius = m_PSettings->gatherRadiusForPass(lastPass);
+    checkpoint.renderSeed = m_PSettings->renderSeed;
+    checkpoint.scatterSeed = m_PSettings->scatterSeed;
+    checkpoint.image = image;
+    if (checkpoint.save(m_checkpointFile)) {
+        printf("Checkpoint of %d passes in %s\n", lastPass + 1, m_checkpointFile.c_str());
+    } else {
+        printf("Could not write %s\n", m_checkpointFile.c_str());
+    }
+}
+
+shared_ptr<Image3> App::copyCanvas() const
+{
+    return Image3::fromArray(m_canvas->getCArray(), m_canvas->width(), m_canvas->height());
+}
+
+void App::canvasChanged()
+{
+    shared_ptr<Image3> snapshot = copyCanvas();
+
+    std::lock_guard<std::mutex> lock(m_canvasLock);
+    m_canvasSnapshot = snapshot;
+    ++m_canvasVersion;
+}
+
+shared_ptr<Image3> App::canvasSnapshot(int *version) const
+{
+    std::lock_guard<std::mutex> lock(m_canvasLock);
+    if (version) {
+        *version = m_canvasVersion;
+    }
+    return m_canvasSnapshot;
+}
+
 void App::onCleanup()
 {
+    if (m_dirBeams) {
+        m_dirBeams->stopWorker();
+    }
     m_world.unload();
 }
 
@@ -328,12 +463,11 @@ void App::makeLinesDirBeams(SlowMesh &mesh)
 {
     if (m_dirBeams)
     {
-        Array<PhotonBeamette> beams = m_dirBeams->getBeams();
-        for (int i=0; i<beams.size(); i++) {
-            PhotonBeamette beam = beams[i];
-            mesh.setColor(beam.m_power / beam.m_power.max());
-            mesh.makeVertex(beam.m_start);
-            mesh.makeVertex(beam.m_end);
+        const Array<SplatVertex> &vertices = m_dirBeams->getSplatVertices();
+        for (int i=0; i<vertices.size(); i+=2) {
+            mesh.setColor(vertices[i].power / vertices[i].power.max());
+            mesh.makeVertex(vertices[i].position);
+            mesh.makeVertex(vertices[i+1].position);
         }
     }
 }
@@ -343,16 +477,17 @@ void App::makeLinesIndirBeams(SlowMesh &mesh)
 {
     if (m_inDirBeams)
     {
-        std::shared_ptr<G3D::KDTree<PhotonBeamette>> t = m_inDirBeams->getBeams();
-        G3D::KDTree<PhotonBeamette>::Iterator end = t->end();
-        G3D::KDTree<PhotonBeamette>::Iterator cur = t->begin();
+        std::shared_ptr<BeamMap> map = m_inDirBeams->getBeams();
+        const BeamStore &beams = map->store();
 
-        while (cur != end)
+        for (int i=0; i<beams.size(); i++)
         {
-            mesh.setColor(cur->m_power / cur->m_power.max());
-            mesh.makeVertex(cur->m_start);
-            mesh.makeVertex(cur->m_end);
-            ++cur;
+            if (!map->isLive(i)) {
+                continue;
+            }
+            mesh.setColor(beams.power(i) / beams.power(i).max());
+            mesh.makeVertex(beams.start(i));
+            mesh.makeVertex(beams.end(i));
         }
     }
 }
@@ -379,11 +514,9 @@ void App::onGraphics3D(RenderDevice *rd, Array<shared_ptr<Surface> > &surface3D)
 {
     if (!m_world.camnull() && m_dirBeams){
 
-
-        m_dirBeams->setRadius(m_radius);
-
-
-        m_dirBeams->makeBeams();
+        // The newest batch of direct beams, if the worker has finished one.
+        // The next batch is scattered with the radius gpuProcess() sets.
+        bool newBeams = m_dirBeams->takeBeams(max(m_radius * m_PSettings->radiusScalingFactor, PhotonSettings::MIN_BEAM_RADIUS));
 
         // camera has changed, reset direct light
         if (indRenderCount == 0 && prevIndRenderCount == -1) {
@@ -392,7 +525,7 @@ void App::onGraphics3D(RenderDevice *rd, Array<shared_ptr<Surface> > &surface3D)
         }
 
 
-        gpuProcess(rd);
+        gpuProcess(rd, newBeams);
     } else {
 
 
@@ -406,113 +539,41 @@ void App::onGraphics3D(RenderDevice *rd, Array<shared_ptr<Surface> > &surface3D)
     }
 }
 
-void App::gpuProcess(RenderDevice *rd)
+void App::gpuProcess(RenderDevice *rd, bool newBeams)
 {
     if (m_passes == 0) {
-
-        rd->pushState(m_ZFBO); {
-            rd->setObjectToWorldMatrix(CFrame());
-            rd->setColorClearValue(Color4::zero());
-            rd->clear();
-            rd->setBlendFunc(RenderDevice::BLEND_ONE, RenderDevice::BLEND_ONE);
-            rd->setProjectionAndCameraMatrix(m_world.camera()->projection(), m_world.camera()->frame());
-
-            Args args;
-            args.setPrimitiveType(PrimitiveType::TRIANGLES);
-            Array<shared_ptr<Surface>> geometry = m_world.geometry();
-            CFrame cframe;
-            for (int i=0; i<geometry.size(); i++)
-            {
-                const shared_ptr<UniversalSurface>& surface = dynamic_pointer_cast<UniversalSurface>(geometry[i]);
-                if (notNull(surface))
-                {
-                    surface->getCoordinateFrame(cframe);
-                    args.setUniform("MVP", rd->invertYMatrix()*rd->projectionMatrix()*rd->cameraToWorldMatrix().inverse() * cframe);
-                    surface->gpuGeom()->setShaderArgs(args);
-                    LAUNCH_SHADER("zBuff.*", args);
-                }
-            }
-        } rd->popState();
+        m_splatPass->renderDepth(rd, m_world);
     }
 
-    Array<PhotonBeamette> direct_beams = Array<PhotonBeamette>();
-    direct_beams.append(m_dirBeams->getBeams());
-
-    float calcRadius = m_radius*m_PSettings->radiusScalingFactor;
-    m_radius = max(calcRadius, 0.05f);
-    m_passes += 1;
+    // Without new beams, the frame only composites the average so far
+    // with the newest indirect canvas
+    if (newBeams) {
+        float calcRadius = m_radius*m_PSettings->radiusScalingFactor;
+        m_radius = max(calcRadius, PhotonSettings::MIN_BEAM_RADIUS);
+        m_passes += 1;
+    }
 
-    // flipFlop FBOs and textures
-    bool isEvenPass = m_passes % 2 == 0;
-    auto prevFBO = isEvenPass ? m_FBO1 : m_FBO2;
-    auto nextFBO = isEvenPass ? m_FBO2 : m_FBO1;
+    // flipFlop FBOs and textures, every frame: one without new beams
+    // carries the average over to the other FBO
+    m_evenFrame = !m_evenFrame;
+    auto prevFBO = m_evenFrame ? m_FBO1 : m_FBO2;
+    auto nextFBO = m_evenFrame ? m_FBO2 : m_FBO1;
 
 
 
     /* splat beams */
 
-    rd->pushState(m_dirFBO); {
-        rd->setProjectionAndCameraMatrix(m_world.camera()->projection(),
-                                         m_world.camera()->frame());
-
-        Array<Vector3>   cpuVertex;
-        Array<Vector3>   cpuMajor;
-        Array<Vector3>   cpuMinor;
-        Array<Color3>    cpuPower;
-
-        for (PhotonBeamette pb : direct_beams) {
-            cpuVertex.append(pb.m_start);
-            cpuVertex.append(pb.m_end);
-
-            cpuMajor.append(pb.m_start_major);
-            cpuMinor.append(pb.m_start_minor);
-            cpuMajor.append(pb.m_end_major);
-            cpuMinor.append(pb.m_end_minor);
-            cpuPower.append(pb.m_power/direct_beams.size() * pow(m_PSettings->beamIntensity, 2));
-            cpuPower.append(pb.m_power/direct_beams.size() * pow(m_PSettings->beamIntensity, 2));
-        }
-
-        rd->setObjectToWorldMatrix(CFrame());
-        rd->setColorClearValue(Color4::zero());
-        rd->clear();
-
-        glEnable(GL_BLEND);
-        rd->setBlendFunc(Framebuffer::COLOR1,
-                         RenderDevice::BLEND_ONE,
-                         RenderDevice::BLEND_ONE,
-                         RenderDevice::BLENDEQ_ADD,
-                         RenderDevice::BLEND_SRC_ALPHA,
-                         RenderDevice::BLEND_DST_ALPHA);
-
-        // Upload to GPU
-        shared_ptr<VertexBuffer> vbuffer = VertexBuffer::create(
-                    sizeof(Vector3) * cpuVertex.size() +
-                    sizeof(Vector3) * cpuMajor.size() +
-                    sizeof(Vector3) * cpuMinor.size() +
-                    sizeof(Color3) * cpuPower.size());
-        AttributeArray gpuVertex   = AttributeArray(cpuVertex, vbuffer);
-        AttributeArray gpuMajor   = AttributeArray(cpuMajor, vbuffer);
-        AttributeArray gpuMinor   = AttributeArray(cpuMinor, vbuffer);
-        AttributeArray gpuPower  = AttributeArray(cpuPower, vbuffer);
-        Args args;
-
-        args.setPrimitiveType(PrimitiveType::LINES);
-        args.setAttributeArray("Position", gpuVertex);
-        args.setAttributeArray("Major", gpuMajor);
-        args.setAttributeArray("Minor", gpuMinor);
-        args.setAttributeArray("Power", gpuPower);
-        args.setUniform("zDepth", m_ZFBO->texture(1), Sampler::buffer());
-        args.setUniform("Resolution", Vector2(rd->width(), rd->height()));
-        args.setUniform("Look", m_world.camera()->frame().lookVector());
-        args.setUniform("MVP",
-                        rd->invertYMatrix() *
-                        (rd->projectionMatrix() *
-                         rd->cameraToWorldMatrix().inverse().toMatrix4()));
-
-        LAUNCH_SHADER("beamsplat.*", args);
-
-    } rd->popState();
-    shared_ptr<Texture> indirectTex = Texture::fromImage("Source", m_canvas);
+    // The power is shared by all the beams scattered, culled or not
+    if (newBeams) {
+        m_splatPass->splat(rd, m_world, m_dirBeams->getSplatVertices(),
+                           m_PSettings->splatPowerScale(m_dirBeams->numBeams()),
+                           m_PSettings->cullBeams);
+    }
+    // The next pass may already be writing to m_canvas
+    int canvasVersion;
+    shared_ptr<Image3> canvas = canvasSnapshot(&canvasVersion);
+    m_canvasTexture.update(canvas, canvasVersion);
+    shared_ptr<Texture> indirectTex = m_canvasTexture.texture();
 
 
     /* composite direct and indirect */
@@ -527,8 +588,9 @@ void App::gpuProcess(RenderDevice *rd)
 
         argsComp.setUniform("Resolution", Vector2(rd->width(), rd->height()));
         argsComp.setUniform("passNum", m_passes);
+        argsComp.setUniform("newSample", newBeams);
         argsComp.setUniform("prevDirectLight", prevFBO->texture(2), Sampler::buffer());
-        argsComp.setUniform("directSample", m_dirFBO->texture(1), Sampler::buffer());
+        argsComp.setUniform("directSample", m_splatPass->directLight(), Sampler::buffer());
         argsComp.setUniform("indirectSample", indirectTex, Sampler::buffer());
 
         LAUNCH_SHADER("composite.*", argsComp);
@@ -556,10 +618,7 @@ void App::gpuProcess(RenderDevice *rd)
 // sets the gather radius of the indirect renderer
 void App::setGatherRadius()
 {
-    // the closer this value is to 1, the slower the radius will decrease.
-    float radReductionRate = 1.08f;
-
-    m_indRenderer->setGatherRadius(m_PSettings->gatherRadius / pow(radReductionRate, (indRenderCount - 1)));
+    m_indRenderer->setGatherRadius(m_PSettings->gatherRadiusForPass(indRenderCount));
 }
 
 void App::loadSceneDirectory(String directory)
@@ -617,10 +676,13 @@ void App::makeGUI()
     settingsPane->addNumberBox(GuiText("Beam Spread"), &m_PSettings->beamSpread, GuiText(""), GuiTheme::LINEAR_SLIDER, 0.001f, 1.0f, 0.005f);
 //    settingsPane->addNumberBox(GuiText("Curve Power"), &m_PSettings->curveScatterPower, GuiText(""), GuiTheme::LINEAR_SLIDER, 1.00f, 2.01f, 1.10f);
     settingsPane->addNumberBox(GuiText("Gather Radius"), &m_PSettings->gatherRadius, GuiText(""), GuiTheme::LINEAR_SLIDER, 0.0f, 1.0f, 0.05f);
+    settingsPane->addNumberBox(GuiText("Beam Refresh"), &m_PSettings->beamRefreshFraction, GuiText(""), GuiTheme::LINEAR_SLIDER, 0.0f, 1.0f, 0.05f);
 
     // Rendering
     GuiPane* renderPane = paneMain->addPane("Render Settings", GuiTheme::ORNATE_PANE_STYLE);
     renderPane->addCheckBox("Use Final Gather", &m_PSettings->useFinalGather);
+    renderPane->addCheckBox("Use Beam Grid", &m_PSettings->useBeamGrid);
+    renderPane->addCheckBox("Cull Beams", &m_PSettings->cullBeams);
     renderPane->pack();
 
     paneMain->pack();
@@ -11,6 +11,10 @@
 #include "indrenderer.h"
 #include "photonsettings.h"
 #include "threadpool.h"
+#include "checkpoint.h"
+#include "canvastexture.h"
+#include "splatpass.h"
+#include <mutex>
 
 /** The entry point and main window manager */
 class App : public GApp
@@ -22,9 +26,19 @@ public:
     App(const GApp::Settings &settings = GApp::Settings());
     virtual ~App();
 
-    /** Calls the shoot() callback until the minumum photon count is met */
+    /** Settings shared by the scatterers and renderers, e.g. to apply command line options */
+    shared_ptr<PhotonSettings> photonSettings() const { return m_PSettings; }
+
+    /** Calls the shoot() callback until the minumum photon count is met.
+      * Without createRngGen, only starts refreshing the indirect beams into
+      * their back buffer on the scatterer's refresh thread, which is safe
+      * while a pass renders. */
     void buildPhotonMap(bool createRngGen);
 
+    /** Waits for the indirect beams scattered by buildPhotonMap(false) and
+      * hands them to the renderer */
+    void swapPhotonMap();
+
     /** Multithreaded callback for tracing gather rays */
     void traceCallback(int x, int y);
 
@@ -61,6 +75,38 @@ public:
 
     void setGatherRadius();
 
+    /** Prints the beam map query counters of the last pass, when RenderStats
+      * is built in */
+    void printGatherStats();
+
+    /** Makes renders save a Checkpoint to path every
+      * PhotonSettings::checkpointInterval passes and when they stop, and
+      * resume from the one already there if it is of the same render. */
+    void setCheckpointFile(const String &path) { m_checkpointFile = path; }
+    const String &checkpointFile() const { return m_checkpointFile; }
+
+    /** Makes scenes load through a cache in directory, see SceneCache */
+    void setSceneCache(const String &directory) { m_sceneCache = directory; }
+
+    /** Restores the canvas and pass count of the checkpoint file, if it is
+      * of the scene being rendered. Call before buildPhotonMap(true). */
+    void resumeCheckpoint();
+
+    /** Writes passes 0 to lastPass, averaged in image, to the checkpoint file */
+    void saveCheckpoint(shared_ptr<Image3> image, int lastPass);
+
+    /** A copy of the canvas */
+    shared_ptr<Image3> copyCanvas() const;
+
+    /** Takes a snapshot of the canvas for the next frame to upload. Call
+      * once the canvas is done changing, e.g. at the end of a pass. */
+    void canvasChanged();
+
+    /** The snapshot taken by the last canvasChanged(), and its version.
+      * Snapshots aren't written to, so they can be read while a pass renders
+      * into the canvas. */
+    shared_ptr<Image3> canvasSnapshot(int *version = NULL) const;
+
     int                 indRenderCount;
     int                 prevIndRenderCount;
     int                 m_maxPasses;
@@ -69,7 +115,9 @@ public:
 
 private:
 
-    void gpuProcess(RenderDevice *rd);
+    /** Splats the direct beams, if there are newBeams, and composites them
+      * with the indirect canvas */
+    void gpuProcess(RenderDevice *rd, bool newBeams);
 
     /** Makes the verts to visualize the indirection lighting */
     void makeLinesIndirBeams(SlowMesh &mesh);
@@ -87,31 +135,37 @@ private:
     static String                   m_scenePath; // path to scene folder
     static String                   m_defaultScene;
 
-    shared_ptr<Texture> m_dirLight;
-    shared_ptr<Texture> m_zBuffer;
     shared_ptr<Texture> m_totalDirLight1;
     shared_ptr<Texture> m_currentComposite1;
     shared_ptr<Texture> m_totalDirLight2;
     shared_ptr<Texture> m_currentComposite2;
 
-    shared_ptr<Framebuffer> m_dirFBO;
     shared_ptr<Framebuffer> m_FBO1;
     shared_ptr<Framebuffer> m_FBO2;
-    shared_ptr<Framebuffer> m_ZFBO;
 
     shared_ptr<PhotonSettings>         m_PSettings;
 
     Random                 m_random;   // Random number generator
 
     std::unique_ptr<DirPhotonScatter> m_dirBeams;
+    std::unique_ptr<SplatPass>        m_splatPass; // direct beams on the GPU
     std::unique_ptr<IndPhotonScatter> m_inDirBeams;
     std::unique_ptr<IndRenderer> m_indRenderer;
+    BeamQueryStats      m_gatherReported; // gather totals printGatherStats() last printed
 
     int                 m_passType;
     shared_ptr<Image3>  m_canvas;   // Output buffer for raytrace()
+    shared_ptr<Image3>  m_canvasSnapshot; // of m_canvas, see canvasChanged()
+    int                 m_canvasVersion; // bumped with each snapshot
+    mutable std::mutex  m_canvasLock;   // guards the snapshot and its version
+    CanvasTexture       m_canvasTexture; // m_canvasSnapshot on the GPU
+    String              m_sceneFile; // scene being rendered
+    String              m_checkpointFile;
+    String              m_sceneCache; // directory scenes are cached in
     shared_ptr<Thread>  m_dispatch; // Spawns rendering threads
     float               m_radius; // Current radius of the beams to be rendered
     int                 m_passes;
+    bool                m_evenFrame; // which of m_FBO1/2 the composite writes
     int                 num_passes;
     bool                m_updating;
     float               m_scaleFactor; // how much to scale down images by.
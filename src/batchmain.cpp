@@ -0,0 +1,215 @@
+#include <G3D/G3DAll.h>
+#include "batchrenderer.h"
+#include "passaccumulator.h"
+
+// Built by illuminati-batch.pro only; icompile builds every source in the
+// directory into the interactive app, which has its own main.
+#ifdef ILLUMINATI_BATCH
+
+G3D_START_AT_MAIN();
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s SCENE [options]\n"
+           "       %s --merge OUTPUT PARTIAL...\n"
+           "  --passes N          progressive passes to render (default: 20)\n"
+           "  --first-pass P      number of the first pass, for one part of a split render (default: 1)\n"
+           "  --pass-stride S     render passes P, P+S, P+2S, ... (default: 1)\n"
+           "  --partial FILE      also write the summed passes, to merge with --merge\n"
+           "  --checkpoint FILE   save the render to FILE as it goes, and resume the one in it\n"
+           "  --direct            add the direct beams, splatted on the CPU\n"
+           "  --scene-cache DIR   cache the parsed scene in DIR, to load faster next time\n"
+           "  --width W           image width (default: 640)\n"
+           "  --height H          image height (default: 400)\n"
+           "  --output FILE       image to write (default: render.png)\n"
+           "  --settings FILE     PhotonSettings { name = value; ... } to apply\n"
+           "  --set NAME=VALUE    a single setting, applied after --settings\n"
+           "  --threads N         number of render threads\n"
+           "  --affinity CPUS     CPUs to pin the render threads to, e.g. 0-7,16-23\n", name, name);
+}
+
+/** Averages the passes of the partials written by split renders into one image */
+static int merge(const String &output, const Array<String> &partials)
+{
+    PassAccumulator total;
+    for (int i = 0; i < partials.size(); ++i)
+    {
+        PassAccumulator partial;
+        if (!partial.load(partials[i]) || !total.add(partial)) {
+            return 1;
+        }
+    }
+
+    if (total.passes().size() == 0) {
+        printf("No passes to merge\n");
+        return 1;
+    }
+
+    // Not an error, the render is just noisier and biased towards the
+    // later passes' smaller radii
+    Array<int> missing = total.missingPasses();
+    if (missing.size() > 0) {
+        printf("Warning: %d of passes 1-%d are missing, first %d\n",
+               missing.size(), total.passes().last(), missing[0]);
+    }
+
+    total.average()->save(output);
+    printf("Merged %d passes into %s\n", total.passes().size(), output.c_str());
+    return 0;
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    if (String(argv[1]) == "--merge")
+    {
+        if (argc < 4) {
+            printUsage(argv[0]);
+            return 1;
+        }
+        Array<String> partials;
+        for (int i = 3; i < argc; ++i)
+        {
+            partials.append(argv[i]);
+        }
+        return merge(argv[2], partials);
+    }
+
+    String scene = argv[1];
+    int numPasses = 20;
+    int firstPass = 1;
+    int passStride = 1;
+    String partialFile;
+    String checkpointFile;
+    int width = 640;
+    int height = 400;
+    String output = "render.png";
+    String settingsFile;
+    Array<String> overrides;
+    int numThreads = 0;
+    Array<int> cpus;
+    bool direct = false;
+    String sceneCache;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        String arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--passes" && hasValue)          numPasses = atoi(argv[++i]);
+        else if (arg == "--first-pass" && hasValue) firstPass = atoi(argv[++i]);
+        else if (arg == "--pass-stride" && hasValue) passStride = atoi(argv[++i]);
+        else if (arg == "--partial" && hasValue)    partialFile = argv[++i];
+        else if (arg == "--checkpoint" && hasValue) checkpointFile = argv[++i];
+        else if (arg == "--direct")                 direct = true;
+        else if (arg == "--scene-cache" && hasValue) sceneCache = argv[++i];
+        else if (arg == "--width" && hasValue)      width = atoi(argv[++i]);
+        else if (arg == "--height" && hasValue)     height = atoi(argv[++i]);
+        else if (arg == "--output" && hasValue)     output = argv[++i];
+        else if (arg == "--settings" && hasValue)   settingsFile = argv[++i];
+        else if (arg == "--set" && hasValue)        overrides.append(argv[++i]);
+        else if (arg == "--threads" && hasValue)    numThreads = atoi(argv[++i]);
+        else if (arg == "--affinity" && hasValue) {
+            if (!ThreadPool::parseCpuList(argv[++i], cpus)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (numPasses <= 0 || firstPass <= 0 || passStride <= 0 || width <= 0 || height <= 0 || numThreads < 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    shared_ptr<PhotonSettings> settings = std::make_shared<PhotonSettings>();
+    if (!settingsFile.empty())
+    {
+        Any table;
+        table.load(settingsFile);
+        if (!settings->set(table)) {
+            return 1;
+        }
+    }
+    for (int i = 0; i < overrides.size(); ++i)
+    {
+        size_t eq = overrides[i].find('=');
+        if (eq == String::npos ||
+            !settings->set(overrides[i].substr(0, eq), Any::parse(overrides[i].substr(eq + 1)))) {
+            printf("Bad setting %s\n", overrides[i].c_str());
+            return 1;
+        }
+    }
+    if (numThreads > 0)
+        settings->numRenderThreads = numThreads;
+    else if (cpus.size() > 0)
+        settings->numRenderThreads = cpus.size();
+    if (cpus.size() > 0)
+        settings->renderAffinity = cpus;
+    if (direct)
+        settings->splatDirect = true;
+
+    // G3D's model loader uploads meshes and textures, so it needs a GL
+    // context even though all the rendering is on the CPU. Make one with a
+    // window that is never shown. A scene in the cache loads without one.
+    RenderDevice *rd = NULL;
+    if (!World::isCached(scene, sceneCache))
+    {
+        initGLG3D();
+        OSWindow::Settings windowSettings;
+        windowSettings.visible = false;
+        windowSettings.width = 16;
+        windowSettings.height = 16;
+        rd = new RenderDevice();
+        rd->init(windowSettings);
+    }
+
+    Array<int> passes;
+    for (int i = 0; i < numPasses; ++i)
+    {
+        passes.append(firstPass + i * passStride);
+    }
+
+    BatchRenderer renderer(settings, width, height);
+    renderer.setSceneCache(sceneCache);
+    renderer.load(scene);
+    renderer.setCheckpointFile(checkpointFile);
+    renderer.render(passes);
+
+    double samples = double(width) * height * numPasses;
+    if (renderer.renderTime() > 0.0) {
+        printf("%d passes of %dx%d in %.2f s (%.0f samples/s, %d threads)\n",
+               numPasses, width, height, renderer.renderTime(),
+               samples / renderer.renderTime(), settings->numRenderThreads);
+    }
+
+    renderer.image()->save(output);
+    printf("Wrote %s\n", output.c_str());
+
+    int result = 0;
+    if (!partialFile.empty())
+    {
+        PassAccumulator partial(*renderer.image(), renderer.passes(), scene, *settings);
+        if (partial.save(partialFile)) {
+            printf("Wrote %s\n", partialFile.c_str());
+        } else {
+            printf("Could not write %s\n", partialFile.c_str());
+            result = 1;
+        }
+    }
+
+    if (rd) {
+        rd->cleanup();
+        delete rd;
+    }
+    return result;
+}
+
+#endif // ILLUMINATI_BATCH
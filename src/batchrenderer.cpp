@@ -0,0 +1,203 @@
+#include "batchrenderer.h"
+#include "renderstats.h"
+
+BatchRenderer::BatchRenderer(shared_ptr<PhotonSettings> settings, int width, int height)
+    : m_PSettings(settings),
+      m_canvas(Image3::createEmpty(width, height)),
+      m_pass(0),
+      m_renderTime(0.0)
+{
+}
+
+BatchRenderer::~BatchRenderer()
+{
+}
+
+void BatchRenderer::load(const String &path)
+{
+    m_world.unload();
+    m_world.setSettings(m_PSettings);
+    m_world.setCacheDirectory(m_sceneCache);
+    m_world.load(path);
+    m_scene = path;
+}
+
+void BatchRenderer::traceCallback(int x, int y)
+{
+    // Each pixel sample draws from its own stream, see SampleContext
+    SampleContext ctx(x, y, m_pass, m_PSettings->renderSeed);
+
+    double dx = ctx.random.uniform(), dy = ctx.random.uniform();
+    Ray ray = m_world.camera()->worldRay(x + dx, y + dy, m_canvas->rect2DBounds());
+    Radiance3 sample = m_indRenderer->trace(ray, m_PSettings->maxDepthScatter, ctx);
+    if (m_direct) {
+        sample += m_direct->get(x, y);
+    }
+
+    // Running average over the passes
+    if (m_passes.size() == 0) {
+        m_canvas->set(x, y, sample);
+    } else {
+        float n = float(m_passes.size() + 1);
+        m_canvas->set(x, y, m_canvas->get(x, y) * ((n - 1.f) / n) + sample / n);
+    }
+}
+
+void BatchRenderer::splatDirect()
+{
+    // The app splats a batch of direct beams each frame, with a shrinking radius
+    RealTime start = System::time();
+    m_dirBeams->reseed(m_pass);
+    m_dirBeams->setRadius(m_PSettings->beamRadiusForPass(m_pass));
+    m_dirBeams->makeBeams();
+    STATS_STAGE(STAGE_SCATTER, System::time() - start);
+
+    m_splatter->splat(m_dirBeams->getSplatVertices(),
+                      m_PSettings->splatPowerScale(m_dirBeams->numBeams()), *m_direct);
+    STATS_STAGE(STAGE_SPLAT, m_splatter->splatTime());
+}
+
+void BatchRenderer::resume(Array<int> &todo)
+{
+    Checkpoint checkpoint;
+    if (!checkpoint.load(m_checkpointFile) ||
+        !checkpoint.matches(m_scene, m_canvas->width(), m_canvas->height(), *m_PSettings)) {
+        return;
+    }
+
+    // The saved passes must be the first ones asked for, in order. Any
+    // other --first-pass, --pass-stride or --passes would mix in passes
+    // this render doesn't have, or skip ones it does.
+    const Array<int> &saved = checkpoint.passes;
+    bool prefix = saved.size() <= todo.size();
+    for (int i = 0; prefix && i < saved.size(); ++i)
+    {
+        prefix = (saved[i] == todo[i]);
+    }
+    if (!prefix) {
+        printf("Not resuming from %s, its passes are not the first of the ones requested\n",
+               m_checkpointFile.c_str());
+        return;
+    }
+
+    m_canvas = checkpoint.image;
+    m_passes = saved;
+    todo.remove(0, saved.size());
+    printf("Resuming from %s after %d passes\n", m_checkpointFile.c_str(), m_passes.size());
+}
+
+void BatchRenderer::saveCheckpoint()
+{
+    Checkpoint checkpoint;
+    checkpoint.scene = m_scene;
+    checkpoint.passes = m_passes;
+    checkpoint.gatherRadius = m_PSettings->gatherRadiusForPass(m_passes.last());
+    checkpoint.renderSeed = m_PSettings->renderSeed;
+    checkpoint.scatterSeed = m_PSettings->scatterSeed;
+    checkpoint.image = m_canvas;
+    if (!checkpoint.save(m_checkpointFile)) {
+        printf("Could not write %s\n", m_checkpointFile.c_str());
+    }
+}
+
+void BatchRenderer::render(int numPasses, PassCallback onPass)
+{
+    Array<int> passes;
+    for (int pass = 1; pass <= numPasses; ++pass)
+    {
+        passes.append(pass);
+    }
+    render(passes, onPass);
+}
+
+void BatchRenderer::render(const Array<int> &passes, PassCallback onPass)
+{
+    RealTime start = System::time();
+    RealTime callbackTime = 0.0;
+    m_passes.fastClear();
+
+    Array<int> todo = passes;
+    if (!m_checkpointFile.empty()) {
+        resume(todo);
+    }
+    if (todo.size() == 0) {
+        m_renderTime = 0.0;
+        return;
+    }
+
+    printf("Scattering ...");
+    fflush(stdout);
+
+    m_inDirBeams = std::make_unique<IndPhotonScatter>(&m_world, m_PSettings);
+    m_inDirBeams->reseed(todo[0]);
+    m_inDirBeams->makeBeams();
+    STATS_STAGE(STAGE_SCATTER, System::time() - start);
+    m_indRenderer = std::make_unique<IndRenderer>(&m_world, m_PSettings);
+    m_indRenderer->setBeams(m_inDirBeams->getBeams());
+    printf("done in %.1f ms\n", (System::time() - start) * 1000.0);
+
+    ThreadPool pool( [this](int x, int y) { traceCallback(x, y); },
+                     m_PSettings->numRenderThreads, m_PSettings->renderAffinity );
+
+    if (m_PSettings->splatDirect) {
+        m_dirBeams = std::make_unique<DirPhotonScatter>(&m_world, m_PSettings);
+        m_splatter = std::make_unique<BeamSplatter>(m_PSettings->numRenderThreads, m_PSettings->renderAffinity);
+        m_splatter->setView(&m_world, m_canvas->width(), m_canvas->height());
+        m_direct = Image3::createEmpty(m_canvas->width(), m_canvas->height());
+    }
+
+    for (int i = 0; i < todo.size(); ++i)
+    {
+        m_pass = todo[i];
+        RealTime indexStart = System::time();
+        m_indRenderer->setGatherRadius(m_PSettings->gatherRadiusForPass(m_pass));
+        STATS_STAGE(STAGE_INDEX, System::time() - indexStart);
+
+        // Scatter the next pass's beams while this pass gathers from the current ones
+        bool scattering = i + 1 < todo.size();
+        if (scattering) {
+            m_inDirBeams->startRefresh();
+        }
+
+        if (m_direct) {
+            splatDirect();
+        }
+        pool.run(m_canvas->width(), m_canvas->height());
+
+        RealTime waitStart = System::time();
+        if (scattering) {
+            m_inDirBeams->waitRefresh();
+            STATS_STAGE(STAGE_SCATTER, m_inDirBeams->refreshTime());
+            m_inDirBeams->swapBeams();
+            m_indRenderer->setBeams(m_inDirBeams->getBeams());
+        }
+        RealTime scatterWait = System::time() - waitStart;
+
+        printf("Pass %d: %.1f ms gathering, %.1f ms waiting on the scatter\n",
+               m_pass, pool.passTime() * 1000.0, scatterWait * 1000.0);
+        fflush(stdout);
+
+        STATS_STAGE(STAGE_GATHER, pool.passTime());
+        STATS_STAGE(STAGE_SCATTER_WAIT, scatterWait);
+        STATS_END_PASS(m_pass);
+        m_passes.append(m_pass);
+
+        int interval = m_PSettings->checkpointInterval;
+        if (!m_checkpointFile.empty() && interval > 0 && m_passes.size() % interval == 0) {
+            saveCheckpoint();
+        }
+
+        if (onPass) {
+            m_renderTime = System::time() - start - callbackTime;
+            RealTime callbackStart = System::time();
+            onPass(m_pass);
+            callbackTime += System::time() - callbackStart;
+        }
+    }
+
+    if (!m_checkpointFile.empty()) {
+        saveCheckpoint();
+    }
+
+    m_renderTime = System::time() - start - callbackTime;
+}
@@ -0,0 +1,100 @@
+#ifndef BATCHRENDERER_H
+#define BATCHRENDERER_H
+#include <G3D/G3DAll.h>
+
+#include "world.h"
+#include "indphotonscatter.h"
+#include "indrenderer.h"
+#include "dirphotonscatter.h"
+#include "beamsplatter.h"
+#include "threadpool.h"
+#include "photonsettings.h"
+#include "checkpoint.h"
+
+/** Renders a scene progressively on the CPU without the G3D GUI.
+  *
+  * Runs the same passes as the interactive app's "Render" button:
+  * the indirect beams are scattered, IndRenderer gathers every pixel on the
+  * thread pool, and the passes are averaged into one image. Like the app,
+  * it scatters the next pass's beams while the current one gathers.
+  *
+  * With PhotonSettings::splatDirect, each pass also scatters a batch of
+  * direct beams and splats it with BeamSplatter, as the app does on the
+  * GPU, and the direct light is added to the pass before it is averaged in.
+  */
+class BatchRenderer
+{
+public:
+    /** Called after each pass with its 1-based (global) number */
+    typedef std::function<void(int)> PassCallback;
+
+    BatchRenderer(shared_ptr<PhotonSettings> settings, int width, int height);
+    ~BatchRenderer();
+
+    /** Loads a scene (*.Scene.Any) */
+    void load(const String &path);
+
+    /** Makes render() save a Checkpoint to path every
+      * PhotonSettings::checkpointInterval passes and when it finishes, and
+      * resume from the one already there if it is of the same render. */
+    void setCheckpointFile(const String &path) { m_checkpointFile = path; }
+
+    /** Makes load() cache scenes in directory, see SceneCache. Call before
+      * load(). */
+    void setSceneCache(const String &directory) { m_sceneCache = directory; }
+
+    /** Renders passes 1 to numPasses, averaging them into the image.
+      * onPass may read image() and renderTime(); the time it takes is not
+      * counted in renderTime(). */
+    void render(int numPasses, PassCallback onPass = PassCallback());
+
+    /** Renders the given passes of a longer render, e.g. every fourth one
+      * for one of four processes. A pass's number picks its gather radius
+      * and pixel seeds, and the first pass's number is mixed into the
+      * scatter seed, so the passes render as they would in the full render
+      * and processes that start at different passes scatter different beams.
+      * See PassAccumulator for merging the results. */
+    void render(const Array<int> &passes, PassCallback onPass = PassCallback());
+
+    /** The passes averaged into image() */
+    const Array<int> &passes() const { return m_passes; }
+
+    /** The average of the passes rendered so far */
+    shared_ptr<Image3> image() const { return m_canvas; }
+
+    /** Seconds spent in render() so far, scattering and gathering */
+    double renderTime() const { return m_renderTime; }
+
+private:
+    /** Traces pixel (x, y) for the current pass and averages it in */
+    void traceCallback(int x, int y);
+
+    /** Scatters and splats the current pass's direct beams into m_direct */
+    void splatDirect();
+
+    /** Restores the passes of the checkpoint file and removes them from todo.
+      * Does nothing if there is no checkpoint of this render, or if its
+      * passes are not the first ones of todo, in order. */
+    void resume(Array<int> &todo);
+
+    /** Writes the passes rendered so far to the checkpoint file */
+    void saveCheckpoint();
+
+    shared_ptr<PhotonSettings>          m_PSettings;
+    World                               m_world;
+    String                              m_scene;
+    String                              m_checkpointFile;
+    String                              m_sceneCache;
+    std::unique_ptr<IndPhotonScatter>   m_inDirBeams;
+    std::unique_ptr<IndRenderer>        m_indRenderer;
+    std::unique_ptr<DirPhotonScatter>   m_dirBeams;
+    std::unique_ptr<BeamSplatter>       m_splatter;
+
+    shared_ptr<Image3>  m_canvas;
+    shared_ptr<Image3>  m_direct;   // direct light of the current pass, with splatDirect
+    int                 m_pass;     // 1-based pass being rendered
+    Array<int>          m_passes;   // passes rendered so far
+    double              m_renderTime;
+};
+
+#endif // BATCHRENDERER_H
@@ -0,0 +1,97 @@
+#include "beambvh.h"
+
+#include <algorithm>
+
+BeamBVH::BeamBVH()
+{
+}
+
+void BeamBVH::build(const BeamStore &beams, const Array<int> &slots)
+{
+    clear();
+    if (slots.size() == 0) {
+        return;
+    }
+
+    Array<AABox> boxes;
+    Array<Point3> centroids;
+    Array<int> order;
+    boxes.resize(slots.size());
+    centroids.resize(slots.size());
+    order.resize(slots.size());
+
+    for (int i = 0; i < slots.size(); ++i)
+    {
+        int b = slots[i];
+        boxes[i] = beams.bounds(b);
+        centroids[i] = (beams.start(b) + beams.end(b)) * 0.5f;
+        order[i] = i;
+    }
+
+    m_nodes.reserve(2 * (slots.size() / LEAF_SIZE + 1));
+    m_start.reserve(slots.size());
+    m_axis.reserve(slots.size());
+    m_slot.reserve(slots.size());
+
+    m_nodes.next();
+    buildNode(0, 0, slots.size(), order, boxes, centroids, beams, slots);
+}
+
+void BeamBVH::buildNode(int node, int first, int count, Array<int> &order,
+                        const Array<AABox> &boxes, const Array<Point3> &centroids,
+                        const BeamStore &beams, const Array<int> &slots)
+{
+    AABox bounds = boxes[order[first]];
+    AABox centroidBounds = AABox(centroids[order[first]]);
+    for (int i = first + 1; i < first + count; ++i)
+    {
+        bounds.merge(boxes[order[i]]);
+        centroidBounds.merge(centroids[order[i]]);
+    }
+    m_nodes[node].bounds = bounds;
+
+    if (count <= LEAF_SIZE)
+    {
+        m_nodes[node].first = m_slot.size();
+        m_nodes[node].count = count;
+        for (int i = first; i < first + count; ++i)
+        {
+            int b = slots[order[i]];
+            m_start.append(beams.start(b));
+            m_axis.append(beams.end(b) - beams.start(b));
+            m_slot.append(b);
+        }
+        return;
+    }
+
+    // Median split along the widest axis of the centroids
+    Vector3 extent = centroidBounds.extent();
+    int axis = (extent.x > extent.y) ? ((extent.x > extent.z) ? 0 : 2) : ((extent.y > extent.z) ? 1 : 2);
+    int half = count / 2;
+    int *begin = order.getCArray() + first;
+    std::nth_element(begin, begin + half, begin + count,
+                     [&centroids, axis](int a, int b) { return centroids[a][axis] < centroids[b][axis]; });
+
+    int left = m_nodes.size();
+    m_nodes.next();
+    m_nodes.next();
+    m_nodes[node].first = left;
+    m_nodes[node].count = 0;
+
+    buildNode(left, first, half, order, boxes, centroids, beams, slots);
+    buildNode(left + 1, first + half, count - half, order, boxes, centroids, beams, slots);
+}
+
+void BeamBVH::clear()
+{
+    m_nodes.fastClear();
+    m_start.fastClear();
+    m_axis.fastClear();
+    m_slot.fastClear();
+}
+
+size_t BeamBVH::sizeInBytes() const
+{
+    return m_nodes.size() * sizeof(Node)
+         + m_slot.size() * (sizeof(Point3) + sizeof(Vector3) + sizeof(int));
+}
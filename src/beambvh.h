@@ -0,0 +1,166 @@
+#ifndef BEAMBVH_H
+#define BEAMBVH_H
+#include <G3D/G3DAll.h>
+
+#include "beamstore.h"
+
+/** Counters filled in by BeamBVH queries */
+struct BeamQueryStats
+{
+    int64   queries = 0;
+    int64   nodesVisited = 0;
+    int64   beamsTested = 0;    // segments whose distance test was run
+    int64   beamsHit = 0;       // segments that passed it
+
+    void add(const BeamQueryStats &other)
+    {
+        queries += other.queries;
+        nodesVisited += other.nodesVisited;
+        beamsTested += other.beamsTested;
+        beamsHit += other.beamsHit;
+    }
+
+    /** The work done since earlier, both totals */
+    BeamQueryStats since(const BeamQueryStats &earlier) const
+    {
+        BeamQueryStats d;
+        d.queries = queries - earlier.queries;
+        d.nodesVisited = nodesVisited - earlier.nodesVisited;
+        d.beamsTested = beamsTested - earlier.beamsTested;
+        d.beamsHit = beamsHit - earlier.beamsHit;
+        return d;
+    }
+};
+
+/** Bounding volume hierarchy over beam segments.
+  *
+  * A gather weighs a beam by the distance from the gather point to the
+  * beam's segment, with a kernel that is zero past the gather radius (see
+  * Utils::cone), so the beams' cross sections play no part in which beams
+  * it needs. The hierarchy indexes the bare segments from start to end, and
+  * its leaves keep a packed copy of them, so queries never read the
+  * BeamStore.
+  *
+  * Queries test the segments exactly against a sphere and call a visitor for
+  * every hit, without allocating.
+  */
+class BeamBVH
+{
+public:
+    BeamBVH();
+
+    /** Builds the hierarchy over the given slots of a store */
+    void build(const BeamStore &beams, const Array<int> &slots);
+
+    void clear();
+
+    int numBeams() const { return m_slot.size(); }
+
+    int numNodes() const { return m_nodes.size(); }
+
+    size_t sizeInBytes() const;
+
+    /** Point of the segment from a to a + ab closest to p */
+    static Point3 closestPoint(const Point3 &p, const Point3 &a, const Vector3 &ab)
+    {
+        float len2 = ab.squaredLength();
+        float t = (len2 > 0.f) ? clamp((p - a).dot(ab) / len2, 0.f, 1.f) : 0.f;
+        return a + ab * t;
+    }
+
+    /** Distance from a point to the segment from a to a + ab */
+    static float segmentDistance(const Point3 &p, const Point3 &a, const Vector3 &ab)
+    {
+        return (p - closestPoint(p, a, ab)).length();
+    }
+
+    /** Squared distance from a point to a box, 0 inside it */
+    static float squaredDistance(const Point3 &p, const AABox &box)
+    {
+        Vector3 d = (box.low() - p).max(p - box.high()).max(Vector3::zero());
+        return d.squaredLength();
+    }
+
+    /** Calls visit(slot, distance) for every beam whose segment is within
+      * radius of center. distance is from center to the segment. Adds the
+      * work done to stats when it isn't null.
+      */
+    template<class Visitor>
+    void forEachIntersecting(const Point3 &center, float radius, Visitor &visit, BeamQueryStats *stats = NULL) const
+    {
+        if (m_nodes.size() == 0) {
+            return;
+        }
+
+        BeamQueryStats local;
+        local.queries = 1;
+
+        int stack[MAX_DEPTH];
+        int top = 0;
+        stack[top++] = 0;
+
+        while (top > 0)
+        {
+            const Node &node = m_nodes[stack[--top]];
+            ++local.nodesVisited;
+
+            if (squaredDistance(center, node.bounds) > square(radius)) {
+                continue;
+            }
+
+            if (node.count > 0)
+            {
+                for (int i = node.first; i < node.first + node.count; ++i)
+                {
+                    ++local.beamsTested;
+                    float dist = segmentDistance(center, m_start[i], m_axis[i]);
+                    if (dist <= radius) {
+                        ++local.beamsHit;
+                        visit(m_slot[i], dist);
+                    }
+                }
+            }
+            else
+            {
+                stack[top++] = node.first;
+                stack[top++] = node.first + 1;
+            }
+        }
+
+        if (stats) {
+            stats->add(local);
+        }
+    }
+
+private:
+    /** Children of an inner node are adjacent, starting at first.
+      * A leaf's beams are count entries of the packed arrays, starting at first.
+      */
+    struct Node
+    {
+        AABox   bounds;
+        int     first;
+        int     count;  // 0 for inner nodes
+    };
+
+    /** Leaves hold at most this many beams */
+    static const int LEAF_SIZE = 4;
+
+    /** Bound on the traversal stack. The median split keeps the tree balanced,
+      * so this covers far more beams than fit in memory. */
+    static const int MAX_DEPTH = 64;
+
+    /** Splits the beams in [first, first + count) under node */
+    void buildNode(int node, int first, int count, Array<int> &order,
+                   const Array<AABox> &boxes, const Array<Point3> &centroids,
+                   const BeamStore &beams, const Array<int> &slots);
+
+    Array<Node>     m_nodes;
+
+    // Packed leaf contents, in tree order
+    Array<Point3>   m_start;
+    Array<Vector3>  m_axis;     // end - start
+    Array<int>      m_slot;
+};
+
+#endif // BEAMBVH_H
@@ -0,0 +1,156 @@
+#include "beamculler.h"
+
+// beamsplat.pix's epsilon for the depth test
+static const float Z_EPS = 0.0001f;
+
+BeamCuller::BeamCuller()
+    : m_frustumCulled(0),
+      m_depthCulled(0)
+{
+}
+
+void BeamCuller::setDepth(const shared_ptr<Image1> &depth)
+{
+    m_levels.fastClear();
+
+    Level &base = m_levels.next();
+    base.width = depth->width();
+    base.height = depth->height();
+    base.depth.resize(base.width * base.height);
+    for (int y = 0; y < base.height; ++y)
+    {
+        for (int x = 0; x < base.width; ++x)
+        {
+            base.depth[y * base.width + x] = depth->get(x, y).value;
+        }
+    }
+
+    while (m_levels.last().width > 1 || m_levels.last().height > 1)
+    {
+        // Appending may move the levels, so both are looked up after it
+        m_levels.next();
+        Level &level = m_levels.last();
+        const Level &below = m_levels[m_levels.size() - 2];
+        level.width = (below.width + 1) / 2;
+        level.height = (below.height + 1) / 2;
+        level.depth.resize(level.width * level.height);
+
+        for (int y = 0; y < level.height; ++y)
+        {
+            int y0 = 2 * y, y1 = min(2 * y + 1, below.height - 1);
+            for (int x = 0; x < level.width; ++x)
+            {
+                int x0 = 2 * x, x1 = min(2 * x + 1, below.width - 1);
+                level.depth[y * level.width + x] =
+                    max(max(below.depth[y0 * below.width + x0], below.depth[y0 * below.width + x1]),
+                        max(below.depth[y1 * below.width + x0], below.depth[y1 * below.width + x1]));
+            }
+        }
+    }
+}
+
+/** Whether all the corners are outside the same clip plane. GL clips away
+  * everything outside -w <= x, y, z <= w. */
+static bool outsideFrustum(const Vector4 corners[4])
+{
+    for (int axis = 0; axis < 3; ++axis)
+    {
+        bool below = true, above = true;
+        for (int i = 0; i < 4; ++i)
+        {
+            below = below && corners[i][axis] < -corners[i].w;
+            above = above && corners[i][axis] > corners[i].w;
+        }
+        if (below || above) {
+            return true;
+        }
+    }
+    return false;
+}
+
+bool BeamCuller::occluded(const Vector4 &start, const Vector4 &end, const Vector4 corners[4]) const
+{
+    if (m_levels.size() == 0 || !(start.w > 0.f) || !(end.w > 0.f)) {
+        return false;
+    }
+
+    // The least depth lookup that passes, for both ends
+    float minDepth = max(start.z / start.w, end.z / end.w) * 0.5f + 0.5f + Z_EPS;
+
+    // Pixel bounds of the quad, rows from the top. Corners behind the
+    // camera don't bound it on screen.
+    const Level &base = m_levels[0];
+    float minX = finf(), maxX = -finf(), minY = finf(), maxY = -finf();
+    for (int i = 0; i < 4; ++i)
+    {
+        if (!(corners[i].w > 0.f)) {
+            return false;
+        }
+        float x = (corners[i].x / corners[i].w * 0.5f + 0.5f) * base.width;
+        float y = (0.5f - corners[i].y / corners[i].w * 0.5f) * base.height;
+        minX = min(minX, x);
+        maxX = max(maxX, x);
+        minY = min(minY, y);
+        maxY = max(maxY, y);
+    }
+    int x0 = iFloor(clamp(minX, 0.f, float(base.width - 1)));
+    int x1 = iFloor(clamp(maxX, 0.f, float(base.width - 1)));
+    int y0 = iFloor(clamp(minY, 0.f, float(base.height - 1)));
+    int y1 = iFloor(clamp(maxY, 0.f, float(base.height - 1)));
+
+    // The finest level where the bounds cover at most 2x2 texels
+    int l = 0;
+    while ((x1 >> l) - (x0 >> l) > 1 || (y1 >> l) - (y0 >> l) > 1)
+    {
+        ++l;
+    }
+
+    const Level &level = m_levels[l];
+    for (int y = y0 >> l; y <= (y1 >> l); ++y)
+    {
+        for (int x = x0 >> l; x <= (x1 >> l); ++x)
+        {
+            if (level.depth[y * level.width + x] >= minDepth) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+int BeamCuller::cull(const Array<SplatVertex> &vertices, const Matrix4 &viewProjection,
+                     const Vector3 &look, SplatVertex *out)
+{
+    m_frustumCulled = 0;
+    m_depthCulled = 0;
+
+    int count = 0;
+    for (int i = 0; i + 1 < vertices.size(); i += 2)
+    {
+        const SplatVertex &start = vertices[i];
+        const SplatVertex &end = vertices[i + 1];
+
+        Vector3 startPerp, endPerp;
+        SplatVertex::perpendiculars(start, end, look, startPerp, endPerp);
+
+        Vector4 corners[4];
+        corners[0] = viewProjection * Vector4(start.position - startPerp, 1.f);
+        corners[1] = viewProjection * Vector4(start.position + startPerp, 1.f);
+        corners[2] = viewProjection * Vector4(end.position - endPerp, 1.f);
+        corners[3] = viewProjection * Vector4(end.position + endPerp, 1.f);
+
+        if (outsideFrustum(corners)) {
+            ++m_frustumCulled;
+            continue;
+        }
+        if (occluded(viewProjection * Vector4(start.position, 1.f),
+                     viewProjection * Vector4(end.position, 1.f), corners)) {
+            ++m_depthCulled;
+            continue;
+        }
+
+        out[count++] = start;
+        out[count++] = end;
+    }
+    return count;
+}
@@ -0,0 +1,59 @@
+#ifndef BEAMCULLER_H
+#define BEAMCULLER_H
+#include <G3D/G3DAll.h>
+
+#include "splatvertex.h"
+
+/** Drops the direct beams that can't add to the splat, before they are
+  * uploaded.
+  *
+  * A beam is dropped if its quad (the one beamsplat.geo makes) is wholly
+  * outside one of the clip planes, or if no pixel under the quad passes
+  * beamsplat.pix's depth test. For the second, the depth zBuff.* renders
+  * is read back once per view and reduced to a pyramid of 2x2 maxima, so
+  * a beam's screen bounds are checked against at most four texels. Both
+  * tests are conservative: the beams left draw the same image.
+  *
+  * Beams that are partly on screen are kept whole rather than clipped,
+  * since the shader's falloff and depth test are taken from the beam's
+  * end points.
+  */
+class BeamCuller
+{
+public:
+    BeamCuller();
+
+    /** Builds the pyramid from the depth zBuff.* rendered, row 0 at the top */
+    void setDepth(const shared_ptr<Image1> &depth);
+
+    /** Copies the beams of vertices that may be visible to out, which has
+      * room for all of them, and returns the number of vertices copied.
+      * viewProjection and look are beamsplat.geo's MVP (without the Y
+      * flip) and Look. */
+    int cull(const Array<SplatVertex> &vertices, const Matrix4 &viewProjection,
+             const Vector3 &look, SplatVertex *out);
+
+    /** Beams the last cull() found off screen */
+    int frustumCulled() const { return m_frustumCulled; }
+
+    /** Beams the last cull() found hidden */
+    int depthCulled() const { return m_depthCulled; }
+
+private:
+    struct Level
+    {
+        int             width;
+        int             height;
+        Array<float>    depth;  // maximum of the texels below, row by row
+    };
+
+    /** Whether every pixel under the quad with clip space corners fails
+      * the depth test for a beam from start to end */
+    bool occluded(const Vector4 &start, const Vector4 &end, const Vector4 corners[4]) const;
+
+    Array<Level>    m_levels;   // level 0 is the depth itself
+    int             m_frustumCulled;
+    int             m_depthCulled;
+};
+
+#endif // BEAMCULLER_H
@@ -0,0 +1,246 @@
+#include "beamgrid.h"
+
+#include <algorithm>
+
+BeamGrid::BeamGrid()
+    : m_built(false),
+      m_queryRadius(0.f),
+      m_invCellSize(1.f),
+      m_mask(0)
+{
+}
+
+void BeamGrid::build(const BeamStore &beams, const Array<int> &slots, float queryRadius, ThreadPool *pool)
+{
+    clear();
+
+    if (!(queryRadius > 0.f) || !isFinite(queryRadius)) {
+        return;
+    }
+
+    for (int i = 0; i < slots.size(); ++i)
+    {
+        int b = slots[i];
+        if (!beams.start(b).isFinite() || !beams.end(b).isFinite()) {
+            continue;
+        }
+        m_start.append(beams.start(b));
+        m_axis.append(beams.end(b) - beams.start(b));
+        m_slot.append(b);
+    }
+
+    m_queryRadius = queryRadius;
+    m_invCellSize = 1.f / queryRadius;
+
+    // Find the cells each beam crosses
+    int numThreads = pool ? pool->numThreads() : 1;
+    int numWorkers = max(1, min(numThreads, m_slot.size()));
+    Array<BuildWorker> workers;
+    workers.resize(numWorkers);
+    for (int w = 0; w < numWorkers; ++w)
+    {
+        workers[w].grid = this;
+        workers[w].first = (m_slot.size() * w) / numWorkers;
+        workers[w].count = (m_slot.size() * (w + 1)) / numWorkers - workers[w].first;
+    }
+    runWorkers(workers, traverseMain, pool);
+
+    // About one bucket per entry
+    int numEntries = 0;
+    for (int w = 0; w < numWorkers; ++w)
+    {
+        numEntries += workers[w].hashes.size();
+    }
+    int numBuckets = 1;
+    while (numBuckets < numEntries) {
+        numBuckets *= 2;
+    }
+    m_mask = uint32(numBuckets - 1);
+
+    // Counting sort by bucket: count per worker, then turn the counts into
+    // write offsets, bucket by bucket and worker by worker within a bucket
+    runWorkers(workers, countMain, pool);
+
+    m_bucketStart.resize(numBuckets + 1);
+    int offset = 0;
+    for (int b = 0; b < numBuckets; ++b)
+    {
+        m_bucketStart[b] = offset;
+        for (int w = 0; w < numWorkers; ++w)
+        {
+            int count = workers[w].histogram[b];
+            workers[w].histogram[b] = offset;
+            offset += count;
+        }
+    }
+    m_bucketStart[numBuckets] = offset;
+
+    m_entries.resize(numEntries);
+    runWorkers(workers, scatterMain, pool);
+
+    m_built = true;
+}
+
+void BeamGrid::traverse(int i, Array<uint32> &hashes) const
+{
+    // Amanatides & Woo, in units of cells
+    Vector3 a = m_start[i] * m_invCellSize;
+    Vector3 d = m_axis[i] * m_invCellSize;
+
+    int cell[3] = { iFloor(a.x), iFloor(a.y), iFloor(a.z) };
+    int last[3] = { iFloor(a.x + d.x), iFloor(a.y + d.y), iFloor(a.z + d.z) };
+    int step[3];
+    float tMax[3];
+    float tDelta[3];
+
+    int numSteps = 0;
+    for (int k = 0; k < 3; ++k)
+    {
+        numSteps += iAbs(last[k] - cell[k]);
+        if (d[k] > 0.f) {
+            step[k] = 1;
+            tDelta[k] = 1.f / d[k];
+            tMax[k] = (cell[k] + 1 - a[k]) * tDelta[k];
+        } else if (d[k] < 0.f) {
+            step[k] = -1;
+            tDelta[k] = -1.f / d[k];
+            tMax[k] = (a[k] - cell[k]) * tDelta[k];
+        } else {
+            step[k] = 0;
+            tDelta[k] = finf();
+            tMax[k] = finf();
+        }
+    }
+
+    int first = hashes.size();
+    float tEnter = 0.f;
+    for (int n = 0; ; ++n)
+    {
+        int k = (tMax[0] < tMax[1]) ? ((tMax[0] < tMax[2]) ? 0 : 2) : ((tMax[1] < tMax[2]) ? 1 : 2);
+        float tExit = (n < numSteps) ? min(tMax[k], 1.f) : 1.f;
+        addNeighbours(cell, a + d * tEnter, a + d * tExit, hashes);
+        if (n == numSteps) {
+            break;
+        }
+        cell[k] += step[k];
+        tMax[k] += tDelta[k];
+        tEnter = tExit;
+    }
+
+    // Rounding can end the walk next to the last cell
+    if (cell[0] != last[0] || cell[1] != last[1] || cell[2] != last[2]) {
+        addNeighbours(last, a + d, a + d, hashes);
+    }
+
+    // Neighbouring cells of the walk share most of their neighbours
+    uint32 *h = hashes.getCArray();
+    std::sort(h + first, h + hashes.size());
+    int end = first;
+    for (int e = first; e < hashes.size(); ++e)
+    {
+        if (e == first || h[e] != h[end - 1]) {
+            h[end++] = h[e];
+        }
+    }
+    hashes.resize(end, false);
+}
+
+void BeamGrid::addNeighbours(const int cell[3], const Vector3 &p, const Vector3 &q, Array<uint32> &hashes)
+{
+    Vector3 low = p.min(q);
+    Vector3 high = p.max(q);
+
+    for (int z = -1; z <= 1; ++z)
+    for (int y = -1; y <= 1; ++y)
+    for (int x = -1; x <= 1; ++x)
+    {
+        // Squared gap between the neighbour and the box, in cells. A cell
+        // is the query radius, the slack covers rounding in the walk.
+        int offset[3] = { x, y, z };
+        float gap2 = 0.f;
+        for (int k = 0; k < 3; ++k)
+        {
+            float cellLow = float(cell[k] + offset[k]);
+            float gap = max(0.f, max(cellLow - high[k], low[k] - (cellLow + 1.f)));
+            gap2 += gap * gap;
+        }
+        if (gap2 <= 1.001f) {
+            hashes.append(hashCell(cell[0] + x, cell[1] + y, cell[2] + z));
+        }
+    }
+}
+
+void BeamGrid::traverseMain(void *arg)
+{
+    BuildWorker *worker = (BuildWorker*)arg;
+    worker->hashes.fastClear();
+    worker->beams.fastClear();
+    for (int i = worker->first; i < worker->first + worker->count; ++i)
+    {
+        int before = worker->hashes.size();
+        worker->grid->traverse(i, worker->hashes);
+        for (int e = before; e < worker->hashes.size(); ++e)
+        {
+            worker->beams.append(i);
+        }
+    }
+}
+
+void BeamGrid::countMain(void *arg)
+{
+    BuildWorker *worker = (BuildWorker*)arg;
+    const BeamGrid *grid = worker->grid;
+
+    worker->histogram.resize(grid->m_mask + 1);
+    for (int b = 0; b < worker->histogram.size(); ++b)
+    {
+        worker->histogram[b] = 0;
+    }
+    for (int e = 0; e < worker->hashes.size(); ++e)
+    {
+        ++worker->histogram[worker->hashes[e] & grid->m_mask];
+    }
+}
+
+void BeamGrid::scatterMain(void *arg)
+{
+    BuildWorker *worker = (BuildWorker*)arg;
+    BeamGrid *grid = worker->grid;
+
+    // Keeps each worker's entries in beam order within a bucket
+    for (int e = 0; e < worker->hashes.size(); ++e)
+    {
+        int b = worker->hashes[e] & grid->m_mask;
+        grid->m_entries[worker->histogram[b]++] = worker->beams[e];
+    }
+}
+
+void BeamGrid::runWorkers(Array<BuildWorker> &workers, void (*fn)(void *), ThreadPool *pool)
+{
+    if (workers.size() == 1)
+    {
+        fn(&workers[0]);
+        return;
+    }
+
+    pool->run(workers.size(), 1, [&](int x, int) { fn(&workers[x]); });
+}
+
+void BeamGrid::clear()
+{
+    m_built = false;
+    m_queryRadius = 0.f;
+    m_mask = 0;
+    m_bucketStart.fastClear();
+    m_entries.fastClear();
+    m_start.fastClear();
+    m_axis.fastClear();
+    m_slot.fastClear();
+}
+
+size_t BeamGrid::sizeInBytes() const
+{
+    return m_bucketStart.size() * sizeof(int)
+         + m_entries.size() * sizeof(int)
+         + m_slot.size() * (sizeof(Point3) + sizeof(Vector3) + sizeof(int));
+}
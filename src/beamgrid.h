@@ -0,0 +1,123 @@
+#ifndef BEAMGRID_H
+#define BEAMGRID_H
+#include <G3D/G3DAll.h>
+
+#include "beamstore.h"
+#include "beambvh.h"
+#include "threadpool.h"
+
+/** Hashed uniform grid over beam segments, for gathers of a fixed radius.
+  *
+  * Cells are as wide as the query radius. Each beam is inserted into every
+  * cell that comes within the query radius of its segment: the cells its
+  * segment crosses (3D-DDA), and those of their neighbours that the part of
+  * the segment in the crossed cell comes close enough to. A query then only
+  * reads the cell of the query point. The cells are hashed into a table of
+  * buckets, which is built with a parallel counting sort.
+  *
+  * Beams with a non-finite endpoint are left out rather than let them
+  * spread over the whole table.
+  */
+class BeamGrid
+{
+public:
+    BeamGrid();
+
+    /** Builds the grid over the given slots of a store, for queries of up to
+      * queryRadius, one share per thread of pool, or on this thread alone
+      * if pool is NULL */
+    void build(const BeamStore &beams, const Array<int> &slots, float queryRadius, ThreadPool *pool);
+
+    void clear();
+
+    /** Whether the grid is built and can answer queries of this radius */
+    bool covers(float radius) const { return m_built && radius <= m_queryRadius; }
+
+    size_t sizeInBytes() const;
+
+    /** Same contract as BeamBVH::forEachIntersecting. The bucket looked at
+      * counts as a node visited. */
+    template<class Visitor>
+    void forEachIntersecting(const Point3 &center, float radius, Visitor &visit, BeamQueryStats *stats = NULL) const
+    {
+        BeamQueryStats local;
+        local.queries = 1;
+
+        int b = bucket(iFloor(center.x * m_invCellSize),
+                       iFloor(center.y * m_invCellSize),
+                       iFloor(center.z * m_invCellSize));
+        ++local.nodesVisited;
+
+        int end = m_bucketStart[b + 1];
+        for (int e = m_bucketStart[b]; e < end; ++e)
+        {
+            int i = m_entries[e];
+
+            // A beam's cells that collide in one bucket are adjacent
+            if (e > m_bucketStart[b] && m_entries[e - 1] == i) {
+                continue;
+            }
+
+            ++local.beamsTested;
+            float dist = BeamBVH::segmentDistance(center, m_start[i], m_axis[i]);
+            if (dist <= radius) {
+                ++local.beamsHit;
+                visit(m_slot[i], dist);
+            }
+        }
+
+        if (stats) {
+            stats->add(local);
+        }
+    }
+
+private:
+    /** Cell coordinates are hashed to a bucket by dropping the high bits */
+    static uint32 hashCell(int x, int y, int z)
+    {
+        return (uint32(x) * 73856093u) ^ (uint32(y) * 19349663u) ^ (uint32(z) * 83492791u);
+    }
+
+    int bucket(int x, int y, int z) const { return int(hashCell(x, y, z) & m_mask); }
+
+    /** Appends the hash of every cell within the query radius of the
+      * segment of beam i, each once */
+    void traverse(int i, Array<uint32> &hashes) const;
+
+    /** Appends the hashes of cell and those of its neighbours within a
+      * cell of the box from p to q, which is inside cell (in cell units) */
+    static void addNeighbours(const int cell[3], const Vector3 &p, const Vector3 &q, Array<uint32> &hashes);
+
+    /** One thread's share of a build */
+    struct BuildWorker
+    {
+        BeamGrid *      grid;
+        int             first;      // packed beams [first, first + count)
+        int             count;
+        Array<uint32>   hashes;     // cells crossed, in beam order
+        Array<int>      beams;      // beam of each cell
+        Array<int>      histogram;  // entries per bucket, then this worker's write offsets
+    };
+
+    static void traverseMain(void *arg);
+    static void countMain(void *arg);
+    static void scatterMain(void *arg);
+
+    /** Runs fn on every worker, each as a task of pool */
+    static void runWorkers(Array<BuildWorker> &workers, void (*fn)(void *), ThreadPool *pool);
+
+    bool            m_built;
+    float           m_queryRadius;
+    float           m_invCellSize;
+    uint32          m_mask;         // number of buckets - 1
+
+    Array<int>      m_bucketStart;  // first entry of each bucket, plus the end
+    Array<int>      m_entries;      // packed beam index per (cell, beam) pair
+
+    // Packed beams
+    Array<Point3>   m_start;
+    Array<Vector3>  m_axis;         // end - start
+    Array<int>      m_slot;
+};
+
+#endif // BEAMGRID_H
@@ -0,0 +1,93 @@
+#include "beammap.h"
+
+BeamMap::BeamMap()
+{
+}
+
+void BeamMap::insert(const BeamStore &beams, int first, int count, Array<int> &slots)
+{
+    for (int i = first; i < first + count; ++i)
+    {
+        int slot;
+        if (m_free.size() > 0) {
+            slot = m_free.pop();
+            m_store.set(slot, beams.get(i));
+        } else {
+            slot = m_store.size();
+            m_store.append(beams, i, 1);
+            m_live.append(false);
+            m_inTree.append(false);
+        }
+        m_live[slot] = true;
+
+        m_pending.append(slot);
+        slots.append(slot);
+    }
+
+    m_grid.clear();
+}
+
+void BeamMap::remove(int slot)
+{
+    if (m_inTree[slot]) {
+        m_inTree[slot] = false;
+    } else {
+        m_pending.fastRemove(m_pending.findIndex(slot));
+    }
+
+    m_live[slot] = false;
+    m_free.append(slot);
+    m_grid.clear();
+}
+
+void BeamMap::clear()
+{
+    m_bvh.clear();
+    m_grid.clear();
+    m_store.clear();
+    m_live.fastClear();
+    m_inTree.fastClear();
+    m_free.fastClear();
+    m_pending.fastClear();
+}
+
+void BeamMap::balance()
+{
+    Array<int> slots;
+    slots.reserve(size());
+    for (int i = 0; i < m_store.size(); ++i)
+    {
+        m_inTree[i] = m_live[i];
+        if (m_live[i]) {
+            slots.append(i);
+        }
+    }
+    m_pending.fastClear();
+
+    m_bvh.build(m_store, slots);
+}
+
+void BeamMap::buildGrid(float queryRadius, ThreadPool *pool)
+{
+    Array<int> slots;
+    slots.reserve(size());
+    for (int i = 0; i < m_store.size(); ++i)
+    {
+        if (m_live[i]) {
+            slots.append(i);
+        }
+    }
+
+    m_grid.build(m_store, slots, queryRadius, pool);
+}
+
+void BeamMap::clearGrid()
+{
+    m_grid.clear();
+}
+
+size_t BeamMap::sizeInBytes() const
+{
+    return m_store.size() * (BeamStore::bytesPerBeam() + 2 * sizeof(bool))
+         + m_bvh.sizeInBytes() + m_grid.sizeInBytes();
+}
@@ -0,0 +1,112 @@
+#ifndef BEAMMAP_H
+#define BEAMMAP_H
+#include <G3D/G3DAll.h>
+
+#include "beamstore.h"
+#include "beambvh.h"
+#include "beamgrid.h"
+
+/** The indirect photon beam map.
+  *
+  * The beams themselves live once, in a structure-of-arrays BeamStore, and a
+  * BeamBVH indexes them for gathers. Removed beams leave a free slot that the
+  * next insert reuses, so slot indices stay valid while the map is updated in
+  * place. The hierarchy is only rebuilt by balance(): until then removed
+  * beams are skipped and inserted ones are tested one by one.
+  *
+  * Optionally, buildGrid() also indexes the beams in a BeamGrid, which then
+  * answers the queries it covers until the map changes.
+  */
+class BeamMap
+{
+public:
+    BeamMap();
+
+    /** Adds count beams of a store, starting at first, and appends their slots.
+      * The new beams are not in the hierarchy until the next balance(). */
+    void insert(const BeamStore &beams, int first, int count, Array<int> &slots);
+
+    /** Removes the beam in a slot */
+    void remove(int slot);
+
+    void clear();
+
+    /** Rebuilds the hierarchy over the current beams */
+    void balance();
+
+    /** Builds a grid over the current beams for queries of up to queryRadius */
+    void buildGrid(float queryRadius, ThreadPool *pool);
+
+    /** Drops the grid, queries go back to the hierarchy */
+    void clearGrid();
+
+    /** Calls visit(slot, distance) for every beam whose segment is within
+      * radius of center, see BeamBVH::forEachIntersecting. Does not allocate.
+      */
+    template<class Visitor>
+    void forEachIntersecting(const Point3 &center, float radius, Visitor &visit, BeamQueryStats *stats = NULL) const
+    {
+        if (m_grid.covers(radius)) {
+            m_grid.forEachIntersecting(center, radius, visit, stats);
+            return;
+        }
+
+        LiveFilter<Visitor> filter(m_inTree, visit);
+        m_bvh.forEachIntersecting(center, radius, filter, stats);
+
+        // Beams inserted since the last balance()
+        for (int i = 0; i < m_pending.size(); ++i)
+        {
+            int slot = m_pending[i];
+            float dist = BeamBVH::segmentDistance(center, m_store.start(slot), m_store.end(slot) - m_store.start(slot));
+            if (stats) {
+                ++stats->beamsTested;
+            }
+            if (dist <= radius) {
+                if (stats) {
+                    ++stats->beamsHit;
+                }
+                visit(slot, dist);
+            }
+        }
+    }
+
+    /** Number of beams in the map */
+    int size() const { return m_store.size() - m_free.size(); }
+
+    /** Storage of all slots, including free ones (see isLive) */
+    const BeamStore& store() const { return m_store; }
+
+    bool isLive(int slot) const { return m_live[slot]; }
+
+    /** Approximate memory used by the beams and the indices, in bytes */
+    size_t sizeInBytes() const;
+
+private:
+    /** Passes on the hierarchy's hits whose slot still holds the beam it was built with */
+    template<class Visitor>
+    struct LiveFilter
+    {
+        const Array<bool> &inTree;
+        Visitor &visit;
+
+        LiveFilter(const Array<bool> &t, Visitor &v) : inTree(t), visit(v) {}
+
+        void operator()(int slot, float dist)
+        {
+            if (inTree[slot]) {
+                visit(slot, dist);
+            }
+        }
+    };
+
+    BeamStore           m_store;
+    Array<bool>         m_live;
+    Array<bool>         m_inTree;   // slot holds the beam the hierarchy was built with
+    Array<int>          m_free;
+    Array<int>          m_pending;  // live slots not in the hierarchy
+    BeamBVH             m_bvh;
+    BeamGrid            m_grid;     // built over the live slots, cleared when they change
+};
+
+#endif // BEAMMAP_H
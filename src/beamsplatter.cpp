@@ -0,0 +1,451 @@
+#include "beamsplatter.h"
+
+#include <smmintrin.h>
+
+// The constants of beamsplat.geo and beamsplat.pix
+static const float EPS = 0.0001f;       // to prevent division by zero
+static const float PWR_CLAMP = 150.0f;  // clamp bound on beam power
+static const float Z_EPS = 0.0001f;     // for the depth test
+static const float POWER_SCALE = 0.005f;
+
+// Front faces summed into a pixel's depth before it is given up on, and
+// how far past one a ray starts looking for the next
+static const int MAX_DEPTH_LAYERS = 16;
+static const float DEPTH_BUMP = 1e-4f;
+
+BeamSplatter::BeamSplatter(int numThreads, const Array<int> &cpus)
+    : m_tracingDepth(false),
+      m_world(NULL),
+      m_width(0),
+      m_height(0),
+      m_tilesX(0),
+      m_tilesY(0),
+      m_binsX(0),
+      m_binsY(0),
+      m_image(NULL),
+      m_splatTime(0.0)
+{
+    m_pool = std::make_shared<ThreadPool>([this](int tx, int ty) { renderTile(tx, ty); },
+                                          numThreads, cpus);
+}
+
+BeamSplatter::~BeamSplatter()
+{
+}
+
+void BeamSplatter::setView(World *world, int width, int height)
+{
+    m_world = world;
+    m_width = width;
+    m_height = height;
+    m_tilesX = (width + TILE_SIZE - 1) / TILE_SIZE;
+    m_tilesY = (height + TILE_SIZE - 1) / TILE_SIZE;
+    m_binsX = (width + BIN_SIZE - 1) / BIN_SIZE;
+    m_binsY = (height + BIN_SIZE - 1) / BIN_SIZE;
+    m_bins.resize(m_binsX * m_binsY);
+
+    // The matrices App::gpuProcess() gives beamsplat.geo, less invertYMatrix()
+    shared_ptr<Camera> camera = world->camera();
+    Matrix4 projection;
+    camera->projection().getProjectUnitMatrix(Rect2D::xywh(0, 0, float(width), float(height)), projection);
+    m_viewProjection = projection * camera->frame().inverse().toMatrix4();
+    m_look = camera->frame().lookVector();
+
+    m_depth.resize(m_tilesX * TILE_SIZE * m_tilesY * TILE_SIZE);
+    for (int i = 0; i < m_depth.size(); ++i)
+    {
+        m_depth[i] = 0.f;
+    }
+
+    m_tracingDepth = true;
+    m_pool->run(m_tilesX, m_tilesY);
+}
+
+void BeamSplatter::splat(const Array<SplatVertex> &vertices, float powerScale, Image3 &image)
+{
+    debugAssert(image.width() == m_width && image.height() == m_height);
+    RealTime start = System::time();
+
+    m_beams.fastClear();
+    m_triangles.fastClear();
+    for (int i = 0; i < m_bins.size(); ++i)
+    {
+        m_bins[i].fastClear();
+    }
+
+    for (int i = 0; i + 1 < vertices.size(); i += 2)
+    {
+        setupBeam(vertices[i], vertices[i + 1], powerScale);
+    }
+
+    m_image = &image;
+    m_tracingDepth = false;
+    m_pool->run(m_tilesX, m_tilesY);
+    m_image = NULL;
+
+    m_splatTime = System::time() - start;
+}
+
+void BeamSplatter::setupBeam(const SplatVertex &start, const SplatVertex &end, float powerScale)
+{
+    // beamsplat.geo
+    Vector3 startPerp, endPerp;
+    SplatVertex::perpendiculars(start, end, m_look, startPerp, endPerp);
+
+    Vector4 s4 = m_viewProjection * Vector4(start.position, 1.f);
+    Vector3 s = s4.xyz() / s4.w;
+    Vector2 s2 = s.xy() * 0.5f + Vector2(0.5f, 0.5f);
+    Vector4 e4 = m_viewProjection * Vector4(end.position, 1.f);
+    Vector3 e = e4.xyz() / e4.w;
+    Vector2 e2 = e.xy() * 0.5f + Vector2(0.5f, 0.5f);
+
+    // Both from the start, as in the shader
+    Vector4 p1 = m_viewProjection * Vector4(start.position + startPerp, 1.f);
+    Vector4 p2 = m_viewProjection * Vector4(start.position + endPerp, 1.f);
+
+    Vector2 bs = ((p1.xy() / p1.w) * 0.5f + Vector2(0.5f, 0.5f)) - s2;
+    Vector2 be = ((p2.xy() / p2.w) * 0.5f + Vector2(0.5f, 0.5f)) - e2;
+
+    Vector3 pwr0 = start.power * powerScale / (pi() * square(max(EPS, start.minor.length())));
+    Vector3 pwr1 = end.power * powerScale / (pi() * square(max(EPS, end.minor.length())));
+
+    if (pwr0.length() > PWR_CLAMP) {
+        pwr0 = pwr0 * (PWR_CLAMP / pwr0.length());
+    }
+    if (pwr1.length() > PWR_CLAMP) {
+        pwr1 = pwr1 * (PWR_CLAMP / pwr1.length());
+    }
+
+    // beamsplat.pix, in its aspect-corrected coordinates
+    float aspect = float(m_height) / float(m_width);
+    Vector2 startpt(s2.x, s2.y * aspect);
+    Vector2 endpt(e2.x, e2.y * aspect);
+    Vector2 startv(bs.x, bs.y * aspect);
+    Vector2 endv(be.x, be.y * aspect);
+
+    Vector2 beam = endpt - startpt;
+    float length = beam.length();
+    if (!(length > 0.f)) {
+        // The shader's normalize() makes every pixel NaN, which GL drops
+        return;
+    }
+    Vector2 nb = beam / length;
+
+    float startRadius = (startv - nb * startv.dot(nb)).length();
+    float endRadius = (endv - nb * endv.dot(nb)).length();
+
+    // The pixel at window position (x, y) is at coord = (x, y) / width
+    Beam &b = m_beams.next();
+    float invWidth = 1.f / float(m_width);
+    b.projX = nb.x * invWidth;
+    b.projY = nb.y * invWidth;
+    b.proj0 = -startpt.dot(nb);
+    b.perpX = -nb.y * invWidth;
+    b.perpY = nb.x * invWidth;
+    b.perp0 = nb.y * startpt.x - nb.x * startpt.y;
+    b.startRadius = startRadius;
+    b.radiusSlope = (endRadius - startRadius) / length;
+    b.minDepth = max(s.z, e.z) * 0.5f + 0.5f + Z_EPS;
+
+    // The triangle strip start - perp, start + perp, end - perp, end + perp
+    ClipVertex v[4];
+    v[0].position = m_viewProjection * Vector4(start.position - startPerp, 1.f);
+    v[1].position = m_viewProjection * Vector4(start.position + startPerp, 1.f);
+    v[2].position = m_viewProjection * Vector4(end.position - endPerp, 1.f);
+    v[3].position = m_viewProjection * Vector4(end.position + endPerp, 1.f);
+    v[0].power = v[1].power = pwr0;
+    v[2].power = v[3].power = pwr1;
+
+    // The strip's second triangle is wound as GL winds it
+    int index = m_beams.size() - 1;
+    clipTriangle(index, v[0], v[1], v[2]);
+    clipTriangle(index, v[2], v[1], v[3]);
+}
+
+void BeamSplatter::clipTriangle(int beam, const ClipVertex &a, const ClipVertex &b, const ClipVertex &c)
+{
+    // A triangle clipped by two planes has at most five vertices
+    ClipVertex poly[8];
+    ClipVertex clipped[8];
+    poly[0] = a;
+    poly[1] = b;
+    poly[2] = c;
+    int n = 3;
+
+    // Near (z >= -w), then far (z <= w); x and y are left to the tile bounds
+    for (int plane = 0; plane < 2; ++plane)
+    {
+        float sign = (plane == 0) ? 1.f : -1.f;
+        int m = 0;
+        for (int i = 0; i < n; ++i)
+        {
+            const ClipVertex &cur = poly[i];
+            const ClipVertex &next = poly[(i + 1) % n];
+            float dc = cur.position.w + sign * cur.position.z;
+            float dn = next.position.w + sign * next.position.z;
+            if (dc >= 0.f) {
+                clipped[m++] = cur;
+            }
+            if ((dc >= 0.f) != (dn >= 0.f)) {
+                float t = dc / (dc - dn);
+                clipped[m].position = cur.position + (next.position - cur.position) * t;
+                clipped[m].power = cur.power + (next.power - cur.power) * t;
+                ++m;
+            }
+        }
+        if (m < 3) {
+            return;
+        }
+        for (int i = 0; i < m; ++i)
+        {
+            poly[i] = clipped[i];
+        }
+        n = m;
+    }
+
+    for (int i = 1; i + 1 < n; ++i)
+    {
+        addTriangle(beam, poly[0], poly[i], poly[i + 1]);
+    }
+}
+
+void BeamSplatter::addTriangle(int beam, const ClipVertex &a, const ClipVertex &b, const ClipVertex &c)
+{
+    const ClipVertex *v[3] = { &a, &b, &c };
+    float x[3], y[3], invW[3];
+    Vector3 power[3];
+    for (int i = 0; i < 3; ++i)
+    {
+        invW[i] = 1.f / v[i]->position.w;
+        x[i] = (v[i]->position.x * invW[i] * 0.5f + 0.5f) * m_width;
+        y[i] = (v[i]->position.y * invW[i] * 0.5f + 0.5f) * m_height;
+        power[i] = v[i]->power * invW[i];
+    }
+
+    // GL culls back faces, and front faces are counter-clockwise
+    float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+    if (!(area > 0.f)) {
+        return;
+    }
+
+    // Pixel centers are at + 0.5
+    float minX = min(x[0], min(x[1], x[2])), maxX = max(x[0], max(x[1], x[2]));
+    float minY = min(y[0], min(y[1], y[2])), maxY = max(y[0], max(y[1], y[2]));
+    int x0 = iCeil(clamp(minX - 0.5f, 0.f, float(m_width)));
+    int x1 = iFloor(clamp(maxX - 0.5f, -1.f, float(m_width - 1))) + 1;
+    int y0 = iCeil(clamp(minY - 0.5f, 0.f, float(m_height)));
+    int y1 = iFloor(clamp(maxY - 0.5f, -1.f, float(m_height - 1))) + 1;
+    if (x0 >= x1 || y0 >= y1) {
+        return;
+    }
+
+    Triangle &t = m_triangles.next();
+    t.beam = beam;
+    t.x0 = x0;
+    t.x1 = x1;
+    t.y0 = y0;
+    t.y1 = y1;
+
+    // Edge i is the one opposite vertex i; its function is vertex i's barycentric
+    for (int i = 0; i < 3; ++i)
+    {
+        int j = (i + 1) % 3, k = (i + 2) % 3;
+        float dx = x[k] - x[j], dy = y[k] - y[j];
+        t.edge[i][0] = -dy / area;
+        t.edge[i][1] = dx / area;
+        t.edge[i][2] = (dy * x[j] - dx * y[j]) / area;
+        t.topLeft[i] = (dy < 0.f) || (dy == 0.f && dx < 0.f);
+    }
+
+    // Attributes interpolate linearly divided by w, as GL's perspective correction
+    for (int p = 0; p < 3; ++p)
+    {
+        t.invW[p] = t.edge[0][p] * invW[0] + t.edge[1][p] * invW[1] + t.edge[2][p] * invW[2];
+        for (int ch = 0; ch < 3; ++ch)
+        {
+            t.power[ch][p] = t.edge[0][p] * power[0][ch] + t.edge[1][p] * power[1][ch] + t.edge[2][p] * power[2][ch];
+        }
+    }
+
+    int index = m_triangles.size() - 1;
+    for (int by = y0 / BIN_SIZE; by <= (y1 - 1) / BIN_SIZE; ++by)
+    {
+        for (int bx = x0 / BIN_SIZE; bx <= (x1 - 1) / BIN_SIZE; ++bx)
+        {
+            m_bins[by * m_binsX + bx].append(index);
+        }
+    }
+}
+
+void BeamSplatter::renderTile(int tx, int ty)
+{
+    if (m_tracingDepth) {
+        depthTile(tx, ty);
+    } else {
+        splatTile(tx, ty);
+    }
+}
+
+void BeamSplatter::depthTile(int tx, int ty)
+{
+    // zBuff.* blends the depth of every front face at a pixel into an R16 target
+    shared_ptr<Camera> camera = m_world->camera();
+    Rect2D viewport = Rect2D::xywh(0, 0, float(m_width), float(m_height));
+    int stride = m_tilesX * TILE_SIZE;
+
+    int yEnd = min(m_height, (ty + 1) * TILE_SIZE);
+    int xEnd = min(m_width, (tx + 1) * TILE_SIZE);
+    for (int y = ty * TILE_SIZE; y < yEnd; ++y)
+    {
+        for (int x = tx * TILE_SIZE; x < xEnd; ++x)
+        {
+            Ray ray = camera->worldRay(x + 0.5f, m_height - y - 0.5f, viewport);
+            float depth = 0.f;
+            for (int layer = 0; layer < MAX_DEPTH_LAYERS && depth < 1.f; ++layer)
+            {
+                float dist;
+                bool backface;
+                if (!m_world->intersectTriangle(ray, dist, backface)) {
+                    break;
+                }
+
+                Point3 hit = ray.origin() + ray.direction() * dist;
+                if (!backface) {
+                    Vector4 clip = m_viewProjection * Vector4(hit, 1.f);
+                    float z = clip.z / clip.w;
+                    if (z >= -1.f && z <= 1.f) {
+                        depth += z * 0.5f + 0.5f;
+                    }
+                }
+                ray = Ray(hit + ray.direction() * DEPTH_BUMP, ray.direction());
+            }
+
+            m_depth[y * stride + x] = float(iRound(min(depth, 1.f) * 65535.f)) / 65535.f;
+        }
+    }
+}
+
+void BeamSplatter::splatTile(int tx, int ty)
+{
+    const int tileX0 = tx * TILE_SIZE;
+    const int tileY0 = ty * TILE_SIZE;
+    const int stride = m_tilesX * TILE_SIZE;
+
+    alignas(16) float sum[3][TILE_SIZE * TILE_SIZE];
+    for (int ch = 0; ch < 3; ++ch)
+    {
+        for (int i = 0; i < TILE_SIZE * TILE_SIZE; ++i)
+        {
+            sum[ch][i] = 0.f;
+        }
+    }
+
+    const Array<int> &bin = m_bins[(tileY0 / BIN_SIZE) * m_binsX + tileX0 / BIN_SIZE];
+    const __m128 lanes = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.f);
+
+    for (int i = 0; i < bin.size(); ++i)
+    {
+        const Triangle &t = m_triangles[bin[i]];
+        const Beam &b = m_beams[t.beam];
+
+        int y0 = max(t.y0, tileY0), y1 = min(t.y1, tileY0 + TILE_SIZE);
+        int x0 = max(t.x0, tileX0), x1 = min(t.x1, tileX0 + TILE_SIZE);
+        if (x0 >= x1 || y0 >= y1) {
+            continue;
+        }
+        // Whole groups of four pixels, which stay inside the padded tile
+        x0 = tileX0 + ((x0 - tileX0) & ~3);
+
+        __m128 edgeA[3], edgeB[3], edgeC[3];
+        for (int e = 0; e < 3; ++e)
+        {
+            edgeA[e] = _mm_set1_ps(t.edge[e][0]);
+            edgeB[e] = _mm_set1_ps(t.edge[e][1]);
+            edgeC[e] = _mm_set1_ps(t.edge[e][2]);
+        }
+        __m128 powerA[3], powerB[3], powerC[3];
+        for (int ch = 0; ch < 3; ++ch)
+        {
+            powerA[ch] = _mm_set1_ps(t.power[ch][0] * POWER_SCALE);
+            powerB[ch] = _mm_set1_ps(t.power[ch][1] * POWER_SCALE);
+            powerC[ch] = _mm_set1_ps(t.power[ch][2] * POWER_SCALE);
+        }
+        const __m128 invWA = _mm_set1_ps(t.invW[0]);
+        const __m128 invWB = _mm_set1_ps(t.invW[1]);
+        const __m128 invWC = _mm_set1_ps(t.invW[2]);
+        const __m128 projX = _mm_set1_ps(b.projX);
+        const __m128 projY = _mm_set1_ps(b.projY);
+        const __m128 proj0 = _mm_set1_ps(b.proj0);
+        const __m128 perpX = _mm_set1_ps(b.perpX);
+        const __m128 perpY = _mm_set1_ps(b.perpY);
+        const __m128 perp0 = _mm_set1_ps(b.perp0);
+        const __m128 startRadius = _mm_set1_ps(b.startRadius);
+        const __m128 radiusSlope = _mm_set1_ps(b.radiusSlope);
+        const __m128 minDepth = _mm_set1_ps(b.minDepth);
+
+        for (int y = y0; y < y1; ++y)
+        {
+            const __m128 fy = _mm_set1_ps(y + 0.5f);
+            for (int x = x0; x < x1; x += 4)
+            {
+                const __m128 fx = _mm_add_ps(_mm_set1_ps(float(x)), lanes);
+
+                // Coverage, with the top-left rule so the quad's shared edge isn't drawn twice
+                __m128 mask = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                for (int e = 0; e < 3; ++e)
+                {
+                    __m128 w = _mm_add_ps(_mm_add_ps(_mm_mul_ps(edgeA[e], fx), _mm_mul_ps(edgeB[e], fy)), edgeC[e]);
+                    mask = _mm_and_ps(mask, t.topLeft[e] ? _mm_cmpge_ps(w, zero) : _mm_cmpgt_ps(w, zero));
+                }
+                if (_mm_movemask_ps(mask) == 0) {
+                    continue;
+                }
+
+                __m128 depth = _mm_loadu_ps(&m_depth[y * stride + x]);
+                mask = _mm_and_ps(mask, _mm_cmpge_ps(depth, minDepth));
+
+                // val = |coord - pt| / r, and sin(acos(val)) = sqrt(1 - val^2).
+                // Outside the beam the shader's acos() is NaN, which GL drops.
+                __m128 proj = _mm_add_ps(_mm_add_ps(_mm_mul_ps(projX, fx), _mm_mul_ps(projY, fy)), proj0);
+                __m128 perp = _mm_add_ps(_mm_add_ps(_mm_mul_ps(perpX, fx), _mm_mul_ps(perpY, fy)), perp0);
+                __m128 radius = _mm_add_ps(startRadius, _mm_mul_ps(radiusSlope, proj));
+                __m128 val = _mm_div_ps(perp, radius);
+                __m128 val2 = _mm_mul_ps(val, val);
+                mask = _mm_and_ps(mask, _mm_cmple_ps(val2, one));
+                if (_mm_movemask_ps(mask) == 0) {
+                    continue;
+                }
+                __m128 falloff = _mm_sqrt_ps(_mm_max_ps(zero, _mm_sub_ps(one, val2)));
+
+                __m128 w = _mm_div_ps(one, _mm_add_ps(_mm_add_ps(_mm_mul_ps(invWA, fx), _mm_mul_ps(invWB, fy)), invWC));
+                falloff = _mm_mul_ps(falloff, w);
+
+                float *out = &sum[0][(y - tileY0) * TILE_SIZE + (x - tileX0)];
+                for (int ch = 0; ch < 3; ++ch)
+                {
+                    __m128 power = _mm_add_ps(_mm_add_ps(_mm_mul_ps(powerA[ch], fx), _mm_mul_ps(powerB[ch], fy)), powerC[ch]);
+                    // A 16-bit target clamps what is blended into it
+                    __m128 color = _mm_min_ps(one, _mm_max_ps(zero, _mm_mul_ps(power, falloff)));
+                    color = _mm_and_ps(mask, color);
+                    float *channel = out + ch * TILE_SIZE * TILE_SIZE;
+                    _mm_store_ps(channel, _mm_add_ps(_mm_load_ps(channel), color));
+                }
+            }
+        }
+    }
+
+    int yEnd = min(m_height, tileY0 + TILE_SIZE);
+    int xEnd = min(m_width, tileX0 + TILE_SIZE);
+    for (int y = tileY0; y < yEnd; ++y)
+    {
+        for (int x = tileX0; x < xEnd; ++x)
+        {
+            int i = (y - tileY0) * TILE_SIZE + (x - tileX0);
+            m_image->set(x, m_height - 1 - y, Color3(min(sum[0][i], 1.f),
+                                                     min(sum[1][i], 1.f),
+                                                     min(sum[2][i], 1.f)));
+        }
+    }
+}
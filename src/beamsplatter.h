@@ -0,0 +1,121 @@
+#ifndef BEAMSPLATTER_H
+#define BEAMSPLATTER_H
+#include <G3D/G3DAll.h>
+
+#include "world.h"
+#include "splatvertex.h"
+#include "threadpool.h"
+
+/** Splats the direct beams on the CPU, as beamsplat.* does on the GPU.
+  *
+  * For renders without a GPU. Each beam is expanded into the same quad as
+  * beamsplat.geo (with the same power clamp), clipped and culled as GL
+  * would, and its pixels are shaded as beamsplat.pix shades them: the
+  * cross-section falloff around the beam's screen line, depth tested
+  * against the depth zBuff.* renders. The depth is traced instead of
+  * rasterized, but is the same sum of front-face depths, and the output is
+  * clamped like the GPU's 16-bit direct light target. Only GL's
+  * quantization is left out.
+  *
+  * The screen is cut into TILE_SIZE tiles that the ThreadPool renders
+  * concurrently. Before that, each quad's triangles are binned into
+  * BIN_SIZE squares, so a tile only looks at the triangles near it. A tile
+  * shades four pixels of a row at a time, with SSE.
+  */
+class BeamSplatter
+{
+public:
+    BeamSplatter(int numThreads = Thread::numCores(), const Array<int> &cpus = Array<int>());
+    ~BeamSplatter();
+
+    /** Renders the depth buffer of the world's camera, at width x height.
+      * Call again when the camera moves, like App redraws its zBuffer. */
+    void setView(World *world, int width, int height);
+
+    /** Splats the beams (start and end SplatVertex each) into image, which
+      * is cleared first and must be the size given to setView(). Each
+      * beam's power is scaled by powerScale, like beamsplat.vrt's. */
+    void splat(const Array<SplatVertex> &vertices, float powerScale, Image3 &image);
+
+    /** Wall-clock time of the last splat(), in seconds */
+    double splatTime() const { return m_splatTime; }
+
+private:
+    /** Tiles are TILE_SIZE pixels square, and rendered by one callback */
+    static const int TILE_SIZE = 8;
+
+    /** Triangles are binned into BIN_SIZE squares, a multiple of TILE_SIZE */
+    static const int BIN_SIZE = 64;
+
+    /** Constants of beamsplat.pix that are the same over a beam's pixels.
+      * The falloff terms are linear in the window position. */
+    struct Beam
+    {
+        float   projX, projY, proj0;    // distance along the beam's screen line
+        float   perpX, perpY, perp0;    // distance across it
+        float   startRadius;            // r at proj = 0
+        float   radiusSlope;            // change of r per unit proj
+        float   minDepth;               // least depth lookup that passes
+    };
+
+    /** One triangle of a beam's quad, in window coordinates */
+    struct Triangle
+    {
+        int     beam;
+        float   edge[3][3];     // a, b, c: barycentric i = a x + b y + c
+        bool    topLeft[3];     // edge i owns the pixels exactly on it
+        float   invW[3];        // plane of 1/w
+        float   power[3][3];    // planes of power/w, per channel
+        int     x0, y0, x1, y1; // pixel bounds, exclusive at the top
+    };
+
+    /** A vertex being clipped: clip space position, and the power it carries */
+    struct ClipVertex
+    {
+        Vector4 position;
+        Vector3 power;
+    };
+
+    /** Expands a beam into its quad and bins the quad's visible triangles */
+    void setupBeam(const SplatVertex &start, const SplatVertex &end, float powerScale);
+
+    /** Clips a triangle to GL's near and far planes and bins what is left */
+    void clipTriangle(int beam, const ClipVertex &a, const ClipVertex &b, const ClipVertex &c);
+
+    /** Bins a front-facing triangle that needs no clipping */
+    void addTriangle(int beam, const ClipVertex &a, const ClipVertex &b, const ClipVertex &c);
+
+    /** Renders tile (tx, ty), for the pool */
+    void renderTile(int tx, int ty);
+
+    /** Traces the depths of the pixels of a tile */
+    void depthTile(int tx, int ty);
+
+    /** Shades the pixels of a tile from its bin's triangles */
+    void splatTile(int tx, int ty);
+
+    shared_ptr<ThreadPool>  m_pool;
+    bool                    m_tracingDepth;     // which one renderTile() does
+
+    World *                 m_world;
+    int                     m_width;
+    int                     m_height;
+    int                     m_tilesX;
+    int                     m_tilesY;
+    int                     m_binsX;
+    int                     m_binsY;
+    Matrix4                 m_viewProjection;   // MVP of beamsplat.geo, without the Y flip
+    Vector3                 m_look;
+
+    // Window coordinates have y up, as gl_FragCoord. Row y of m_depth is
+    // image row m_height - 1 - y; it is padded to whole tiles with zeros.
+    Array<float>            m_depth;
+    Array<Beam>             m_beams;
+    Array<Triangle>         m_triangles;
+    Array<Array<int>>       m_bins;             // triangle indices per bin
+    Image3 *                m_image;            // being splatted into
+
+    double                  m_splatTime;
+};
+
+#endif // BEAMSPLATTER_H
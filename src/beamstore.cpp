@@ -0,0 +1,86 @@
+#include "beamstore.h"
+
+BeamStore::BeamStore()
+{
+}
+
+void BeamStore::clear()
+{
+    m_start.fastClear();
+    m_end.fastClear();
+    m_startMajor.fastClear();
+    m_startMinor.fastClear();
+    m_endMajor.fastClear();
+    m_endMinor.fastClear();
+    m_power.fastClear();
+}
+
+void BeamStore::append(const PhotonBeamette &beam)
+{
+    m_start.append(beam.m_start);
+    m_end.append(beam.m_end);
+    m_startMajor.append(beam.m_start_major);
+    m_startMinor.append(beam.m_start_minor);
+    m_endMajor.append(beam.m_end_major);
+    m_endMinor.append(beam.m_end_minor);
+    m_power.append(beam.m_power);
+}
+
+void BeamStore::append(const BeamStore &beams, int first, int count)
+{
+    for (int i = first; i < first + count; ++i)
+    {
+        m_start.append(beams.m_start[i]);
+        m_end.append(beams.m_end[i]);
+        m_startMajor.append(beams.m_startMajor[i]);
+        m_startMinor.append(beams.m_startMinor[i]);
+        m_endMajor.append(beams.m_endMajor[i]);
+        m_endMinor.append(beams.m_endMinor[i]);
+        m_power.append(beams.m_power[i]);
+    }
+}
+
+void BeamStore::append(const BeamStore &beams)
+{
+    m_start.append(beams.m_start);
+    m_end.append(beams.m_end);
+    m_startMajor.append(beams.m_startMajor);
+    m_startMinor.append(beams.m_startMinor);
+    m_endMajor.append(beams.m_endMajor);
+    m_endMinor.append(beams.m_endMinor);
+    m_power.append(beams.m_power);
+}
+
+void BeamStore::set(int i, const PhotonBeamette &beam)
+{
+    m_start[i] = beam.m_start;
+    m_end[i] = beam.m_end;
+    m_startMajor[i] = beam.m_start_major;
+    m_startMinor[i] = beam.m_start_minor;
+    m_endMajor[i] = beam.m_end_major;
+    m_endMinor[i] = beam.m_end_minor;
+    m_power[i] = beam.m_power;
+}
+
+PhotonBeamette BeamStore::get(int i) const
+{
+    PhotonBeamette beam;
+    beam.m_start = m_start[i];
+    beam.m_end = m_end[i];
+    beam.m_start_major = m_startMajor[i];
+    beam.m_start_minor = m_startMinor[i];
+    beam.m_end_major = m_endMajor[i];
+    beam.m_end_minor = m_endMinor[i];
+    beam.m_power = m_power[i];
+    return beam;
+}
+
+AABox BeamStore::bounds(int i) const
+{
+    return AABox(m_start[i].min(m_end[i]), m_start[i].max(m_end[i]));
+}
+
+size_t BeamStore::bytesPerBeam()
+{
+    return 2 * sizeof(Point3) + 4 * sizeof(Vector3) + sizeof(Power3);
+}
@@ -0,0 +1,61 @@
+#ifndef BEAMSTORE_H
+#define BEAMSTORE_H
+#include <G3D/G3DAll.h>
+
+#include "photonbeamette.h"
+
+/** Structure-of-arrays storage for photon beamettes.
+  *
+  * Each field of the beams lives in its own packed array, so a pass over one
+  * field (e.g. the endpoints during a gather) only touches that field's
+  * memory. The spline id of emitted beams is not kept: stored beams never
+  * follow a spline.
+  */
+class BeamStore
+{
+public:
+    BeamStore();
+
+    int size() const { return m_start.size(); }
+
+    /** Removes all beams, keeping the memory */
+    void clear();
+
+    void append(const PhotonBeamette &beam);
+
+    /** Appends count beams of another store, starting at first */
+    void append(const BeamStore &beams, int first, int count);
+
+    void append(const BeamStore &beams);
+
+    /** Overwrites beam i */
+    void set(int i, const PhotonBeamette &beam);
+
+    /** Reassembles beam i */
+    PhotonBeamette get(int i) const;
+
+    const Point3&  start(int i) const       { return m_start[i]; }
+    const Point3&  end(int i) const         { return m_end[i]; }
+    const Vector3& startMajor(int i) const  { return m_startMajor[i]; }
+    const Vector3& startMinor(int i) const  { return m_startMinor[i]; }
+    const Vector3& endMajor(int i) const    { return m_endMajor[i]; }
+    const Vector3& endMinor(int i) const    { return m_endMinor[i]; }
+    const Power3&  power(int i) const       { return m_power[i]; }
+
+    /** Bounds of the segment from start to end */
+    AABox bounds(int i) const;
+
+    /** Bytes of storage per beam */
+    static size_t bytesPerBeam();
+
+private:
+    Array<Point3>   m_start;
+    Array<Point3>   m_end;
+    Array<Vector3>  m_startMajor;
+    Array<Vector3>  m_startMinor;
+    Array<Vector3>  m_endMajor;
+    Array<Vector3>  m_endMinor;
+    Array<Power3>   m_power;
+};
+
+#endif // BEAMSTORE_H
@@ -0,0 +1,345 @@
+#include <G3D/G3DAll.h>
+#include "world.h"
+#include "dirphotonscatter.h"
+#include "indphotonscatter.h"
+#include "indrenderer.h"
+#include "threadpool.h"
+#include "splatpass.h"
+#include "beamsplatter.h"
+
+// Built by illuminati-bench.pro only; icompile builds every source in the
+// directory into the interactive app, which has its own main.
+#ifdef ILLUMINATI_BENCH
+
+G3D_START_AT_MAIN();
+
+/** Benchmarks the stages of the renderer, one at a time, on every scene in a
+  * directory, and writes the results as JSON:
+  *
+  *   { "scenes": [ { "scene": ..., "dirScatterMs": ..., "splat": {...},
+  *                   "indirect": [...], "gather": [...],
+  *                   "traceRaysPerSec": ... }, ... ] }
+  *
+  * It also checks BeamSplatter against the GPU's splat on each scene, and
+  * fails if one is further off than --max-splat-rms.
+  *
+  * All the random streams use the default fixed seeds, so runs are
+  * repeatable for a given thread count.
+  */
+
+static const char *TRACER_NAMES[] = { "recursive", "iterative", "wavefront" };
+
+/** Timed runs of each gather stage, after a warm-up run */
+static const int GATHER_REPEATS = 5;
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [options]\n"
+           "  --scenes DIR        directory of *.Scene.Any files (default: ../data-files/scene)\n"
+           "  --output FILE       JSON results (default: bench.json)\n"
+           "  --width W           image width of the gather and trace stages (default: 320)\n"
+           "  --height H          image height of the gather and trace stages (default: 200)\n"
+           "  --max-splat-rms R   fail if a scene's CPU splat differs from the GPU's by more than\n"
+           "                      R RMS, relative to the GPU's mean (default: 0.05)\n"
+           "  --set NAME=VALUE    a PhotonSettings value for every stage\n", name);
+}
+
+/** Camera ray through the center of pixel (x, y) */
+static Ray pixelRay(World &world, int x, int y, int width, int height)
+{
+    return world.camera()->worldRay(x + 0.5f, y + 0.5f, Rect2D::xywh(0, 0, float(width), float(height)));
+}
+
+/** Splats the direct beams on the GPU and with BeamSplatter, at width x
+  * height, and returns the RMS difference of the two over the GPU's mean */
+static double benchSplat(RenderDevice *rd, World &world, const PhotonSettings &settings,
+                         const DirPhotonScatter &dir, int width, int height, FILE *out)
+{
+    const Array<SplatVertex> &vertices = dir.getSplatVertices();
+    float powerScale = settings.splatPowerScale(dir.numBeams());
+
+    SplatPass gpuSplat(width, height);
+    gpuSplat.renderDepth(rd, world);
+    gpuSplat.splat(rd, world, vertices, powerScale, settings.cullBeams);
+    shared_ptr<Image3> gpu = gpuSplat.directLight()->toImage3();
+
+    BeamSplatter splatter(settings.numRenderThreads, settings.renderAffinity);
+    splatter.setView(&world, width, height);
+    shared_ptr<Image3> cpu = Image3::createEmpty(width, height);
+    splatter.splat(vertices, powerScale, *cpu);
+
+    double squaredError = 0.0, gpuSum = 0.0;
+    for (int y = 0; y < height; ++y)
+    {
+        for (int x = 0; x < width; ++x)
+        {
+            Color3 difference = cpu->get(x, y) - gpu->get(x, y);
+            squaredError += difference.dot(difference);
+            gpuSum += gpu->get(x, y).sum();
+        }
+    }
+    double samples = 3.0 * width * height;
+    double rms = sqrt(squaredError / samples);
+    double gpuMean = gpuSum / samples;
+    // A scene whose beams are all hidden has nothing to be relative to
+    double relativeRms = (gpuMean > 0.0) ? rms / gpuMean : rms;
+
+    fprintf(out, "      \"splat\": { \"cpuMs\": %.3f, \"rms\": %.6f, \"gpuMean\": %.6f, \"relativeRms\": %.6f },\n",
+            splatter.splatTime() * 1000.0, rms, gpuMean, relativeRms);
+    printf("    CPU splat: %.1f ms, RMS difference %.5f from the GPU's (%.2f%% of its mean)\n",
+           splatter.splatTime() * 1000.0, rms, 100.0 * relativeRms);
+    return relativeRms;
+}
+
+/** Times the indirect scatter with one tracer, returns the map it built */
+static shared_ptr<BeamMap> benchIndirect(World &world, const PhotonSettings &base, int tracer, FILE *out)
+{
+    shared_ptr<PhotonSettings> settings = std::make_shared<PhotonSettings>(base);
+    settings->useIterativeScatter = (tracer >= 1);
+    settings->useWavefrontScatter = (tracer == 2);
+
+    IndPhotonScatter scatter(&world, settings);
+    scatter.makeBeams();
+    shared_ptr<BeamMap> map = scatter.getBeams();
+
+    fprintf(out, "        { \"tracer\": \"%s\", \"scatterMs\": %.3f, \"buildMs\": %.3f, \"beams\": %d, \"bytes\": %llu }",
+            TRACER_NAMES[tracer], scatter.scatterTime() * 1000.0, scatter.buildTime() * 1000.0,
+            map->size(), (unsigned long long)map->sizeInBytes());
+    printf("    %s scatter: %.1f ms, build %.1f ms, %d beams\n", TRACER_NAMES[tracer],
+           scatter.scatterTime() * 1000.0, scatter.buildTime() * 1000.0, map->size());
+    return map;
+}
+
+/** Times IndRenderer::diffuse alone, on one thread, at the primary hits of a
+  * width x height image. After a warm-up pass over the hits, the gathers are
+  * timed GATHER_REPEATS times and the median is reported. */
+static void benchGather(World &world, const PhotonSettings &base, shared_ptr<BeamMap> map,
+                        bool useGrid, int width, int height, FILE *out)
+{
+    shared_ptr<PhotonSettings> settings = std::make_shared<PhotonSettings>(base);
+    settings->useBeamGrid = useGrid;
+    settings->useFinalGather = false;
+
+    // Each hit keeps its pixel, which seeds its SampleContext as in a render
+    Array<shared_ptr<Surfel>> hits;
+    Array<Vector3> wo;
+    Array<Vector2int32> pixels;
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            Ray ray = pixelRay(world, x, y, width, height);
+            float dist = 0;
+            shared_ptr<Surfel> surf;
+            world.intersect(ray, dist, surf);
+            if (surf) {
+                hits.append(surf);
+                wo.append(-ray.direction());
+                pixels.append(Vector2int32(x, y));
+            }
+        }
+
+    IndRenderer renderer(&world, settings);
+    renderer.setBeams(map);
+
+    RealTime start = System::time();
+    renderer.setGatherRadius(settings->gatherRadius);
+    RealTime indexTime = System::time() - start;
+
+    auto gatherAll = [&]() {
+        for (int i = 0; i < hits.size(); ++i)
+        {
+            SampleContext ctx(pixels[i].x, pixels[i].y, 0, settings->renderSeed);
+            renderer.diffuse(hits[i], wo[i], settings->maxDepthScatter, ctx);
+        }
+    };
+
+    // The first pass also faults in the map and fills the caches
+    gatherAll();
+
+    BeamQueryStats before = IndRenderer::gatherTotals();
+    Array<RealTime> gatherTimes;
+    for (int r = 0; r < GATHER_REPEATS; ++r)
+    {
+        start = System::time();
+        gatherAll();
+        gatherTimes.append(System::time() - start);
+    }
+    gatherTimes.sort();
+    RealTime gatherTime = gatherTimes[gatherTimes.size() / 2];
+
+    BeamQueryStats stats = IndRenderer::gatherTotals().since(before);
+    double gathersPerSec = (gatherTime > 0) ? hits.size() / gatherTime : 0.0;
+
+    fprintf(out, "        { \"index\": \"%s\", \"indexMs\": %.3f, \"gathers\": %d, \"repeats\": %d, "
+                 "\"gathersPerSec\": %.1f, \"minGathersPerSec\": %.1f, \"maxGathersPerSec\": %.1f",
+            useGrid ? "grid" : "bvh", indexTime * 1000.0, hits.size(), GATHER_REPEATS, gathersPerSec,
+            (gatherTimes.last() > 0) ? hits.size() / gatherTimes.last() : 0.0,
+            (gatherTimes[0] > 0) ? hits.size() / gatherTimes[0] : 0.0);
+    // The query counts come from RenderStats, built with CONFIG+=stats
+    if (stats.queries > 0) {
+        double queries = double(stats.queries);
+        fprintf(out, ", \"nodesPerQuery\": %.2f, \"beamsTestedPerQuery\": %.2f, \"beamsHitPerQuery\": %.2f",
+                stats.nodesVisited / queries, stats.beamsTested / queries, stats.beamsHit / queries);
+    }
+    fprintf(out, " }");
+    printf("    %s gather: %.0f gathers/s (median of %d)\n", useGrid ? "grid" : "bvh",
+           gathersPerSec, GATHER_REPEATS);
+}
+
+/** Times full IndRenderer::trace calls over a width x height image on the render pool */
+static double benchTrace(World &world, const PhotonSettings &base, shared_ptr<BeamMap> map, int width, int height)
+{
+    shared_ptr<PhotonSettings> settings = std::make_shared<PhotonSettings>(base);
+
+    IndRenderer renderer(&world, settings);
+    renderer.setBeams(map);
+    renderer.setGatherRadius(settings->gatherRadius);
+
+    ThreadPool pool( [&](int x, int y) {
+                         SampleContext ctx(x, y, 0, settings->renderSeed);
+                         renderer.trace(pixelRay(world, x, y, width, height), settings->maxDepthScatter, ctx);
+                     },
+                     settings->numRenderThreads, settings->renderAffinity );
+    pool.run(width, height);
+
+    double raysPerSec = double(width) * height / pool.passTime();
+    printf("    trace: %.0f rays/s on %d threads\n", raysPerSec, settings->numRenderThreads);
+    return raysPerSec;
+}
+
+/** Benchmarks one scene, returns the relative RMS of its CPU splat */
+static double benchScene(RenderDevice *rd, const String &path, const PhotonSettings &base,
+                         int width, int height, FILE *out)
+{
+    shared_ptr<PhotonSettings> settings = std::make_shared<PhotonSettings>(base);
+
+    World world;
+    world.setSettings(settings);
+    world.load(path);
+
+    fprintf(out, "    {\n      \"scene\": \"%s\",\n", FilePath::baseExt(path).c_str());
+
+    DirPhotonScatter dir(&world, settings);
+    RealTime start = System::time();
+    dir.makeBeams();
+    double dirTime = System::time() - start;
+    fprintf(out, "      \"dirScatterMs\": %.3f,\n      \"dirBeams\": %d,\n", dirTime * 1000.0, dir.numBeams());
+    printf("    direct scatter: %.1f ms\n", dirTime * 1000.0);
+
+    double splatRms = benchSplat(rd, world, *settings, dir, width, height, out);
+
+    // Scatter with each tracer. The gathers use the map of the default one.
+    fprintf(out, "      \"indirect\": [\n");
+    shared_ptr<BeamMap> map;
+    for (int tracer = 0; tracer < 3; ++tracer)
+    {
+        shared_ptr<BeamMap> built = benchIndirect(world, *settings, tracer, out);
+        if (settings->useIterativeScatter == (tracer >= 1) && settings->useWavefrontScatter == (tracer == 2))
+            map = built;
+        fprintf(out, tracer < 2 ? ",\n" : "\n");
+    }
+    fprintf(out, "      ],\n");
+
+    fprintf(out, "      \"gather\": [\n");
+    benchGather(world, *settings, map, false, width, height, out);
+    fprintf(out, ",\n");
+    benchGather(world, *settings, map, true, width, height, out);
+    fprintf(out, "\n      ],\n");
+
+    double raysPerSec = benchTrace(world, *settings, map, width, height);
+    fprintf(out, "      \"traceRaysPerSec\": %.1f\n    }", raysPerSec);
+
+    world.unload();
+    return splatRms;
+}
+
+int main(int argc, const char *argv[])
+{
+    String sceneDir = "../data-files/scene";
+    String output = "bench.json";
+    int width = 320;
+    int height = 200;
+    double maxSplatRms = 0.05;
+    PhotonSettings settings;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--scenes" && hasValue)          sceneDir = argv[++i];
+        else if (arg == "--output" && hasValue)     output = argv[++i];
+        else if (arg == "--width" && hasValue)      width = atoi(argv[++i]);
+        else if (arg == "--height" && hasValue)     height = atoi(argv[++i]);
+        else if (arg == "--max-splat-rms" && hasValue) maxSplatRms = atof(argv[++i]);
+        else if (arg == "--set" && hasValue)
+        {
+            String set = argv[++i];
+            size_t eq = set.find('=');
+            if (eq == String::npos || !settings.set(set.substr(0, eq), Any::parse(set.substr(eq + 1)))) {
+                printf("Bad setting %s\n", set.c_str());
+                return 1;
+            }
+        }
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (width <= 0 || height <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    Array<String> scenes;
+    FileSystem::getFiles(sceneDir + "/*.Scene.Any", scenes, true);
+    scenes.sort();
+    if (scenes.size() == 0) {
+        printf("No scenes in %s\n", sceneDir.c_str());
+        return 1;
+    }
+
+    FILE *out = fopen(output.c_str(), "w");
+    if (!out) {
+        printf("Could not write %s\n", output.c_str());
+        return 1;
+    }
+
+    // G3D's model loader needs a GL context, see batchmain.cpp
+    initGLG3D();
+    OSWindow::Settings windowSettings;
+    windowSettings.visible = false;
+    windowSettings.width = 16;
+    windowSettings.height = 16;
+    RenderDevice *rd = new RenderDevice();
+    rd->init(windowSettings);
+
+    fprintf(out, "{\n  \"width\": %d,\n  \"height\": %d,\n  \"renderThreads\": %d,\n  \"scatterThreads\": %d,\n"
+                 "  \"beamsInDir\": %d,\n  \"scenes\": [\n",
+            width, height, settings.numRenderThreads, settings.numScatterThreads, settings.numBeamettesInDir);
+    Array<String> splatFailures;
+    for (int i = 0; i < scenes.size(); ++i)
+    {
+        printf("%s\n", scenes[i].c_str());
+        if (!(benchScene(rd, scenes[i], settings, width, height, out) <= maxSplatRms)) {
+            splatFailures.append(FilePath::baseExt(scenes[i]));
+        }
+        fprintf(out, i + 1 < scenes.size() ? ",\n" : "\n");
+        fflush(out);
+    }
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    printf("Wrote %s\n", output.c_str());
+
+    rd->cleanup();
+    delete rd;
+
+    for (int i = 0; i < splatFailures.size(); ++i)
+    {
+        printf("%s: CPU splat differs from the GPU's by more than %g RMS\n",
+               splatFailures[i].c_str(), maxSplatRms);
+    }
+    return (splatFailures.size() > 0) ? 1 : 0;
+}
+
+#endif // ILLUMINATI_BENCH
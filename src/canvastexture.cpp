@@ -0,0 +1,55 @@
+#include "canvastexture.h"
+
+#include <cstring>
+
+CanvasTexture::CanvasTexture()
+    : m_pbo(0),
+      m_version(-1)
+{
+}
+
+CanvasTexture::~CanvasTexture()
+{
+    if (m_pbo) {
+        glDeleteBuffers(1, &m_pbo);
+    }
+}
+
+void CanvasTexture::update(const shared_ptr<Image3> &canvas, int version)
+{
+    int width = canvas->width();
+    int height = canvas->height();
+    bool resized = !m_texture || m_texture->width() != width || m_texture->height() != height;
+    if (!resized && version == m_version) {
+        return;
+    }
+
+    if (resized) {
+        m_texture = Texture::createEmpty("Source", width, height, ImageFormat::RGB32F());
+    }
+    if (!m_pbo) {
+        glGenBuffers(1, &m_pbo);
+    }
+
+    // Orphan the buffer's previous storage, which the driver may still be
+    // reading from, instead of waiting for it
+    size_t bytes = size_t(width) * height * sizeof(Color3);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, m_pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    void *pixels = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes,
+                                    GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+    if (pixels) {
+        memcpy(pixels, canvas->getCArray(), bytes);
+        glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+        // Sources from the bound buffer, offset 0, and returns before the copy is done
+        GLint previous = 0;
+        glGetIntegerv(GL_TEXTURE_BINDING_2D, &previous);
+        glBindTexture(GL_TEXTURE_2D, m_texture->openGLID());
+        glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+        glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, GL_RGB, GL_FLOAT, NULL);
+        glBindTexture(GL_TEXTURE_2D, previous);
+        m_version = version;
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
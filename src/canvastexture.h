@@ -0,0 +1,32 @@
+#ifndef CANVASTEXTURE_H
+#define CANVASTEXTURE_H
+#include <G3D/G3DAll.h>
+
+/** The GPU copy of the CPU-rendered canvas.
+  *
+  * The canvas changes once per render pass, but is drawn every frame. The
+  * texture is kept between frames and only uploaded again when the
+  * canvas's version changes. The upload goes through a pixel buffer: the
+  * pixels are copied into freshly orphaned buffer memory, and the texture
+  * is filled from the buffer by the driver, without the GUI thread waiting
+  * for the transfer.
+  */
+class CanvasTexture
+{
+public:
+    CanvasTexture();
+    ~CanvasTexture();
+
+    /** Uploads the canvas if version differs from the last upload's, or
+      * the canvas has been resized */
+    void update(const shared_ptr<Image3> &canvas, int version);
+
+    shared_ptr<Texture> texture() const { return m_texture; }
+
+private:
+    shared_ptr<Texture> m_texture;
+    GLuint              m_pbo;
+    int                 m_version;  // of the last upload
+};
+
+#endif // CANVASTEXTURE_H
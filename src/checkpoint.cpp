@@ -0,0 +1,123 @@
+#include "checkpoint.h"
+
+#include <cstdio>
+
+// "ILCK", then a format version
+static const uint32 MAGIC = 0x4B434C49;
+// 2: passes normalized by their own gather radius, see Utils::cone
+static const uint32 VERSION = 2;
+
+Checkpoint::Checkpoint()
+    : gatherRadius(0.f),
+      renderSeed(0),
+      scatterSeed(0)
+{
+}
+
+bool Checkpoint::save(const String &path) const
+{
+    if (!image) {
+        return false;
+    }
+
+    String temp = path + ".tmp";
+    {
+        BinaryOutput out(temp, G3D_LITTLE_ENDIAN);
+        out.writeUInt32(MAGIC);
+        out.writeUInt32(VERSION);
+        out.writeString32(scene);
+        out.writeFloat32(gatherRadius);
+        out.writeUInt32(renderSeed);
+        out.writeUInt32(scatterSeed);
+        out.writeInt32(passes.size());
+        for (int i = 0; i < passes.size(); ++i)
+        {
+            out.writeInt32(passes[i]);
+        }
+        out.writeInt32(image->width());
+        out.writeInt32(image->height());
+        for (int y = 0; y < image->height(); ++y)
+            for (int x = 0; x < image->width(); ++x)
+            {
+                Color3 c = image->get(x, y);
+                out.writeFloat32(c.r);
+                out.writeFloat32(c.g);
+                out.writeFloat32(c.b);
+            }
+        out.commit();
+        if (!out.ok()) {
+            return false;
+        }
+    }
+    return ::rename(temp.c_str(), path.c_str()) == 0;
+}
+
+bool Checkpoint::load(const String &path)
+{
+    if (!FileSystem::exists(path)) {
+        return false;
+    }
+
+    BinaryInput in(path, G3D_LITTLE_ENDIAN);
+    if (in.getLength() < 8 || in.readUInt32() != MAGIC || in.readUInt32() != VERSION) {
+        printf("%s is not a checkpoint\n", path.c_str());
+        return false;
+    }
+
+    scene = in.readString32();
+    gatherRadius = in.readFloat32();
+    renderSeed = in.readUInt32();
+    scatterSeed = in.readUInt32();
+
+    int numPasses = in.readInt32();
+    if (numPasses < 0 || in.getPosition() + int64(numPasses) * 4 + 8 > in.getLength()) {
+        printf("%s is truncated\n", path.c_str());
+        return false;
+    }
+    passes.resize(numPasses);
+    for (int i = 0; i < numPasses; ++i)
+    {
+        passes[i] = in.readInt32();
+    }
+
+    int width = in.readInt32();
+    int height = in.readInt32();
+    if (width <= 0 || height <= 0 || in.getPosition() + int64(width) * height * 12 != in.getLength()) {
+        printf("%s is truncated\n", path.c_str());
+        return false;
+    }
+    image = Image3::createEmpty(width, height);
+    for (int y = 0; y < height; ++y)
+        for (int x = 0; x < width; ++x)
+        {
+            Color3 c;
+            c.r = in.readFloat32();
+            c.g = in.readFloat32();
+            c.b = in.readFloat32();
+            image->set(x, y, c);
+        }
+    return true;
+}
+
+bool Checkpoint::matches(const String &scene, int width, int height, const PhotonSettings &settings) const
+{
+    if (scene != this->scene) {
+        printf("Checkpoint is of %s, not %s\n", this->scene.c_str(), scene.c_str());
+        return false;
+    }
+    if (!image || image->width() != width || image->height() != height) {
+        printf("Checkpoint is not %dx%d\n", width, height);
+        return false;
+    }
+    if (renderSeed != settings.renderSeed || scatterSeed != settings.scatterSeed) {
+        printf("Checkpoint has other seeds\n");
+        return false;
+    }
+    // Catches a changed gather radius schedule
+    if (passes.size() > 0 && !fuzzyEq(gatherRadius, settings.gatherRadiusForPass(passes.last()))) {
+        printf("Checkpoint has gather radius %g at pass %d, the settings %g\n",
+               gatherRadius, passes.last(), settings.gatherRadiusForPass(passes.last()));
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,41 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+#include <G3D/G3DAll.h>
+
+#include "photonsettings.h"
+
+/** The state a progressive render needs to continue after it stopped.
+  *
+  * The pixel streams are seeded by pass (see SampleContext) and the gather
+  * radius follows the pass too, so the passes rendered and their running
+  * average are enough to pick up where the render left off. The scatter
+  * streams restart from IndPhotonScatter::reseed() with the next pass:
+  * the resumed render converges like the uninterrupted one, but is not
+  * the same image bit for bit.
+  */
+class Checkpoint
+{
+public:
+    Checkpoint();
+
+    /** Writes to a temporary file next to path, then renames it over path,
+      * so a crash while writing leaves the previous checkpoint intact.
+      * Returns false if it couldn't. */
+    bool save(const String &path) const;
+
+    /** Reads a checkpoint written by save(). Returns false if the file
+      * doesn't exist or isn't one. */
+    bool load(const String &path);
+
+    /** Whether this checkpoint is of the given render. Prints why not. */
+    bool matches(const String &scene, int width, int height, const PhotonSettings &settings) const;
+
+    String              scene;
+    Array<int>          passes;         // passes averaged into image
+    float               gatherRadius;   // radius of the last pass
+    uint32              renderSeed;
+    uint32              scatterSeed;
+    shared_ptr<Image3>  image;
+};
+
+#endif // CHECKPOINT_H
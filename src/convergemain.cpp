@@ -0,0 +1,239 @@
+#include <G3D/G3DAll.h>
+#include "batchrenderer.h"
+
+// Built by illuminati-converge.pro only; icompile builds every source in the
+// directory into the interactive app, which has its own main.
+#ifdef ILLUMINATI_CONVERGE
+
+G3D_START_AT_MAIN();
+
+/** Measures how fast a configuration converges.
+  *
+  * Renders a reference for the scene with many passes (or loads one saved by
+  * an earlier run), then renders the candidate configuration pass by pass and
+  * records the RMSE of its running average against the reference, and the
+  * render time so far, after every pass:
+  *
+  *   { "scene": ..., "overrides": [ ... ], "passes": [ { "pass": 1, "seconds": ..., "rmse": ... }, ... ] }
+  *
+  * Runs of different code versions against the same reference file can then
+  * be compared as error over time curves.
+  *
+  * The gather radius shrinks with every pass, and after a few hundred
+  * passes no beam is close enough to gather, so the reference is rendered
+  * with the radius held at a floor (PhotonSettings::minGatherRadius). The
+  * radius of its last pass is saved beside it, and a reference without one
+  * or with a smaller one is refused.
+  */
+
+static void printUsage(const char *name)
+{
+    printf("Usage: %s SCENE [options]\n"
+           "  --reference FILE        reference image, rendered and saved if missing (default: reference.exr)\n"
+           "  --reference-passes N    passes to render the reference with (default: 1000)\n"
+           "  --reference-min-radius R  floor of the reference's gather radius (default: 0.01)\n"
+           "  --passes N              passes of the candidate (default: 50)\n"
+           "  --width W               image width (default: 320)\n"
+           "  --height H              image height (default: 200)\n"
+           "  --output FILE           JSON results (default: converge.json)\n"
+           "  --scene-cache DIR       cache the parsed scene in DIR, to load faster next time\n"
+           "  --settings FILE         PhotonSettings for both the reference and the candidate\n"
+           "  --set NAME=VALUE        a setting of the candidate only, applied after --settings\n", name);
+}
+
+/** Root mean square difference of two images of the same size, over all channels */
+static double rmse(const Image3 &image, const Image3 &reference)
+{
+    double sum = 0.0;
+    for (int y = 0; y < image.height(); ++y)
+        for (int x = 0; x < image.width(); ++x)
+        {
+            Color3 d = image.get(x, y) - reference.get(x, y);
+            sum += double(d.r) * d.r + double(d.g) * d.g + double(d.b) * d.b;
+        }
+    return sqrt(sum / (3.0 * image.width() * image.height()));
+}
+
+/** The file the radius of a reference's last pass is saved in */
+static String referenceInfoFile(const String &referenceFile)
+{
+    return referenceFile + ".Any";
+}
+
+int main(int argc, const char *argv[])
+{
+    if (argc < 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    String scene = argv[1];
+    String referenceFile = "reference.exr";
+    int referencePasses = 1000;
+    float referenceMinRadius = 0.01f;
+    int numPasses = 50;
+    int width = 320;
+    int height = 200;
+    String output = "converge.json";
+    String settingsFile;
+    Array<String> overrides;
+    String sceneCache;
+
+    for (int i = 2; i < argc; ++i)
+    {
+        String arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--reference" && hasValue)               referenceFile = argv[++i];
+        else if (arg == "--reference-passes" && hasValue)   referencePasses = atoi(argv[++i]);
+        else if (arg == "--reference-min-radius" && hasValue) referenceMinRadius = float(atof(argv[++i]));
+        else if (arg == "--passes" && hasValue)             numPasses = atoi(argv[++i]);
+        else if (arg == "--width" && hasValue)              width = atoi(argv[++i]);
+        else if (arg == "--height" && hasValue)             height = atoi(argv[++i]);
+        else if (arg == "--output" && hasValue)             output = argv[++i];
+        else if (arg == "--scene-cache" && hasValue)        sceneCache = argv[++i];
+        else if (arg == "--settings" && hasValue)           settingsFile = argv[++i];
+        else if (arg == "--set" && hasValue)                overrides.append(argv[++i]);
+        else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
+    if (numPasses <= 0 || referencePasses <= 0 || !(referenceMinRadius > 0.f) || width <= 0 || height <= 0) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    shared_ptr<PhotonSettings> base = std::make_shared<PhotonSettings>();
+    if (!settingsFile.empty())
+    {
+        Any table;
+        table.load(settingsFile);
+        if (!base->set(table)) {
+            return 1;
+        }
+    }
+
+    shared_ptr<PhotonSettings> candidate = std::make_shared<PhotonSettings>(*base);
+    for (int i = 0; i < overrides.size(); ++i)
+    {
+        size_t eq = overrides[i].find('=');
+        if (eq == String::npos ||
+            !candidate->set(overrides[i].substr(0, eq), Any::parse(overrides[i].substr(eq + 1)))) {
+            printf("Bad setting %s\n", overrides[i].c_str());
+            return 1;
+        }
+    }
+
+    shared_ptr<Image3> reference;
+    if (FileSystem::exists(referenceFile))
+    {
+        reference = Image3::fromFile(referenceFile);
+        if (reference->width() != width || reference->height() != height) {
+            printf("%s is %dx%d, not %dx%d\n", referenceFile.c_str(),
+                   reference->width(), reference->height(), width, height);
+            return 1;
+        }
+
+        // References rendered without the floor don't hold the indirect light
+        String infoFile = referenceInfoFile(referenceFile);
+        if (!FileSystem::exists(infoFile)) {
+            printf("%s has no %s, delete it to render it again\n", referenceFile.c_str(), infoFile.c_str());
+            return 1;
+        }
+        Any info;
+        info.load(infoFile);
+        // Nor do those of a kernel that wasn't normalized per pass
+        if (!info.containsKey("coneNormalization") || info["coneNormalization"].string() != "perPass") {
+            printf("%s was rendered with an older gather kernel; delete it to render it again\n", referenceFile.c_str());
+            return 1;
+        }
+        float lastRadius = float(info["lastRadius"].number());
+        if (lastRadius < referenceMinRadius) {
+            printf("%s was rendered down to radius %g, below the floor %g; delete it to render it again\n",
+                   referenceFile.c_str(), lastRadius, referenceMinRadius);
+            return 1;
+        }
+        printf("Using reference %s\n", referenceFile.c_str());
+    }
+
+    FILE *out = fopen(output.c_str(), "w");
+    if (!out) {
+        printf("Could not write %s\n", output.c_str());
+        return 1;
+    }
+
+    // G3D's model loader needs a GL context, unless the scene is cached,
+    // see batchmain.cpp. Nothing below returns early, so it is always
+    // cleaned up.
+    RenderDevice *rd = NULL;
+    if (!World::isCached(scene, sceneCache))
+    {
+        initGLG3D();
+        OSWindow::Settings windowSettings;
+        windowSettings.visible = false;
+        windowSettings.width = 16;
+        windowSettings.height = 16;
+        rd = new RenderDevice();
+        rd->init(windowSettings);
+    }
+
+    if (!reference)
+    {
+        // Other seeds than the candidate's, so their noise is not correlated
+        shared_ptr<PhotonSettings> settings = std::make_shared<PhotonSettings>(*base);
+        settings->renderSeed = ~settings->renderSeed;
+        settings->scatterSeed = ~settings->scatterSeed;
+        settings->minGatherRadius = max(settings->minGatherRadius, referenceMinRadius);
+
+        printf("Rendering reference with %d passes, gather radius down to %g\n",
+               referencePasses, settings->gatherRadiusForPass(referencePasses));
+        BatchRenderer renderer(settings, width, height);
+        renderer.setSceneCache(sceneCache);
+        renderer.load(scene);
+        renderer.render(referencePasses);
+        reference = renderer.image();
+        reference->save(referenceFile);
+
+        Any info(Any::TABLE, "ConvergeReference");
+        info["passes"] = referencePasses;
+        info["lastRadius"] = settings->gatherRadiusForPass(referencePasses);
+        info["coneNormalization"] = "perPass";
+        info.save(referenceInfoFile(referenceFile));
+        printf("Wrote %s\n", referenceFile.c_str());
+    }
+
+    fprintf(out, "{\n  \"scene\": \"%s\",\n  \"reference\": \"%s\",\n  \"width\": %d,\n  \"height\": %d,\n"
+                 "  \"beamsInDir\": %d,\n  \"beamRefreshFraction\": %g,\n  \"gatherRadius\": %g,\n"
+                 "  \"renderThreads\": %d,\n  \"overrides\": [",
+            FilePath::baseExt(scene).c_str(), FilePath::baseExt(referenceFile).c_str(), width, height,
+            candidate->numBeamettesInDir, candidate->beamRefreshFraction, candidate->gatherRadius,
+            candidate->numRenderThreads);
+    for (int i = 0; i < overrides.size(); ++i)
+    {
+        fprintf(out, "%s\"%s\"", (i > 0) ? ", " : " ", overrides[i].c_str());
+    }
+    fprintf(out, " ],\n  \"passes\": [\n");
+
+    BatchRenderer renderer(candidate, width, height);
+    renderer.setSceneCache(sceneCache);
+    renderer.load(scene);
+    renderer.render(numPasses, [&](int pass) {
+        double error = rmse(*renderer.image(), *reference);
+        fprintf(out, "    { \"pass\": %d, \"seconds\": %.4f, \"rmse\": %.6g }%s\n",
+                pass, renderer.renderTime(), error, (pass < numPasses) ? "," : "");
+        fflush(out);
+    });
+
+    fprintf(out, "  ]\n}\n");
+    fclose(out);
+    printf("Wrote %s\n", output.c_str());
+
+    if (rd) {
+        rd->cleanup();
+        delete rd;
+    }
+    return 0;
+}
+
+#endif // ILLUMINATI_CONVERGE
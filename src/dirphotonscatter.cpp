@@ -4,24 +4,49 @@
 
 DirPhotonScatter::DirPhotonScatter(World * world, shared_ptr<PhotonSettings> settings)
     : PhotonScatter(world, settings),
-      m_beams()
+      m_ready(false),
+      m_stop(false),
+      m_nextRadius(0.f)
 {
 }
 
 DirPhotonScatter::~DirPhotonScatter()
 {
+    stopWorker();
 }
 
 void DirPhotonScatter::preprocess()
 {
-    Array<PhotonBeamette> newBeams;
+    scatter(m_splat);
+}
+
+void DirPhotonScatter::scatter(Array<SplatVertex> &out)
+{
+    if (m_PSettings->useWavefrontScatter)
+    {
+        // Stores from first bounce
+        Array<int> beamPaths;
+        shootRaysWavefront(m_path, beamPaths, m_PSettings->numBeamettesDir, m_PSettings->numBeamettesDir, 1);
+        storePaths(out);
+        return;
+    }
+
     // Send out a beam, recursively bounce it around, and then store it in our beams array.
     for (int i=0; i<m_PSettings->numBeamettesDir; i++)
     {
         // Stores from first bounce
-        shootRay(newBeams, m_PSettings->numBeamettesDir, 1);
-        m_beams.append(newBeams);
+        shootRay(m_path, m_PSettings->numBeamettesDir, 1);
+        storePaths(out);
+    }
+}
+
+void DirPhotonScatter::storePaths(Array<SplatVertex> &out)
+{
+    for (int i = 0; i < m_path.size(); ++i)
+    {
+        SplatVertex::append(out, m_path.get(i));
     }
+    m_path.clear();
 }
 
 void DirPhotonScatter::phaseFxn(Vector3 wi, Vector3 &wo)
@@ -30,17 +55,87 @@ void DirPhotonScatter::phaseFxn(Vector3 wi, Vector3 &wo)
     wo = Vector3::cosPowHemiRandom(-wi, power, m_random);
 }
 
-Array<PhotonBeamette> DirPhotonScatter::getBeams()
+const Array<SplatVertex>& DirPhotonScatter::getSplatVertices() const
 {
-    return m_beams;
+    return m_splat;
 }
 
 void DirPhotonScatter::makeBeams()
 {
-    m_beams.clear();
+    m_splat.fastClear();
     preprocess();
 }
 
+void DirPhotonScatter::reseed(int pass)
+{
+    m_random.reset(m_PSettings->scatterSeedForPass(pass), false);
+}
+
+void DirPhotonScatter::startWorker(float radius)
+{
+    stopWorker();
+
+    m_stop = false;
+    m_ready = false;
+    m_nextRadius = radius;
+    m_worker = Thread::create("dirScatter", workerMain, this);
+    m_worker->start();
+}
+
+void DirPhotonScatter::stopWorker()
+{
+    if (!m_worker) {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_cond.notify_all();
+    m_worker->waitForCompletion();
+    m_worker.reset();
+}
+
+bool DirPhotonScatter::takeBeams(float radius)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_ready) {
+            return false;
+        }
+        Array<SplatVertex>::swap(m_splat, m_back);
+        m_nextRadius = radius;
+        m_ready = false;
+    }
+    m_cond.notify_all();
+    return true;
+}
+
+void DirPhotonScatter::workerMain(void *arg)
+{
+    DirPhotonScatter *self = (DirPhotonScatter*)arg;
+
+    std::unique_lock<std::mutex> lock(self->m_mutex);
+    while (true)
+    {
+        // Wait for the last batch to be taken
+        self->m_cond.wait(lock, [self] { return self->m_stop || !self->m_ready; });
+        if (self->m_stop) {
+            return;
+        }
+
+        // Only the worker touches the back buffer, the radius and the random stream until m_ready
+        self->setRadius(self->m_nextRadius);
+        lock.unlock();
+        self->m_back.fastClear();
+        self->scatter(self->m_back);
+        lock.lock();
+
+        self->m_ready = true;
+    }
+}
+
 
 float DirPhotonScatter::getRayMarchDist()
 {
@@ -1,8 +1,19 @@
 #ifndef DIRPHOTONSCATTER_H
 #define DIRPHOTONSCATTER_H
 #include "photonscatter.h"
+#include "splatvertex.h"
 #include <G3D/G3DAll.h>
+#include <mutex>
+#include <condition_variable>
 
+/** Scatters the direct beams, which are splatted on the GPU every frame.
+  *
+  * Either synchronously with makeBeams(), or on a worker thread: after
+  * startWorker(), the worker scatters a batch into a back buffer while the
+  * GUI draws the front one, and takeBeams() swaps in the newest completed
+  * batch. The worker stays one batch ahead, so it only costs a CPU while
+  * frames are being drawn.
+  */
 class DirPhotonScatter
     : public PhotonScatter
 {
@@ -11,11 +22,51 @@ public:
     ~DirPhotonScatter();
     void preprocess();
     void phaseFxn(Vector3 wi, Vector3 &wo);
-    Array<PhotonBeamette> getBeams();
+
+    /** The beams, two vertices (start, end) each, ready to copy to the GPU */
+    const Array<SplatVertex>& getSplatVertices() const;
+
+    int numBeams() const { return m_splat.size() / 2; }
+
     void makeBeams();
+
+    /** Restarts the random stream for a (1-based) pass of a batch render.
+      * The indirect workers of a render starting at that pass use the
+      * streams after it, see IndPhotonScatter::reseed(). */
+    void reseed(int pass);
     float getRayMarchDist();
+
+    /** Starts scattering batches on the worker, the first with the given beam radius */
+    void startWorker(float radius);
+
+    /** Waits for the batch in progress and stops the worker */
+    void stopWorker();
+
+    /** If the worker has completed a batch since the last call, makes it
+      * the one getSplatVertices() returns, has the worker start the next
+      * one with the given beam radius, and returns true. */
+    bool takeBeams(float radius);
+
 private:
-    Array<PhotonBeamette> m_beams;
+    /** Appends a batch of beams to out */
+    void scatter(Array<SplatVertex> &out);
+
+    /** Moves the beams of the paths just traced from m_path to out */
+    void storePaths(Array<SplatVertex> &out);
+
+    /** Worker thread entry point, arg is the scatterer */
+    static void workerMain(void *arg);
+
+    Array<SplatVertex> m_splat;     // front buffer, drawn
+    Array<SplatVertex> m_back;      // back buffer, scattered into by the worker
+    BeamStore m_path;   // beams of the paths being traced
+
+    shared_ptr<Thread>      m_worker;
+    std::mutex              m_mutex;
+    std::condition_variable m_cond;
+    bool                    m_ready;        // m_back holds a completed batch
+    bool                    m_stop;
+    float                   m_nextRadius;   // beam radius of the next batch
 };
 
 #endif // DIRPHOTONSCATTER_H
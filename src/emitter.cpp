@@ -2,15 +2,17 @@
 #include <G3D/G3DAll.h>
 
 Emitter::Emitter():
-    m_splineIndex(-1)
+    m_splineIndex(-1),
+    m_triIndex(-1)
 //      m_splineIndex(index),
 //      m_tri(tri)
 {
 }
 
-Emitter::Emitter(int index, Tri &tri){
+Emitter::Emitter(int index, Tri &tri, int triIndex){
     m_splineIndex = index;
     m_tri = tri;
+    m_triIndex = triIndex;
 }
 
 Emitter::~Emitter(){
@@ -6,18 +6,23 @@ class Emitter
 {
 public:
     Emitter();
-    Emitter(int index, Tri &tri);
+    Emitter(int index, Tri &tri, int triIndex);
     ~Emitter();
     int m_splineIndex; // index for associated spline (-1 if not associated with any spline aka normal area light)
     Tri m_tri;
+    int m_triIndex; // index of the triangle in the world's TriTree
 
-    int index(){
+    int index() const {
         return m_splineIndex;
     }
 
-    Tri tri(){
+    const Tri& tri() const {
         return m_tri;
     }
+
+    int triIndex() const {
+        return m_triIndex;
+    }
 };
 
 #endif // EMITTER_H
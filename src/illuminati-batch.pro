@@ -0,0 +1,16 @@
+QT -= core gui
+TARGET = photon-batch
+TEMPLATE = app
+
+# Headless CPU renderer, see batchrenderer.h
+
+include(illuminati.pri)
+
+DEFINES += ILLUMINATI_BATCH
+
+SOURCES += batchrenderer.cpp \
+    passaccumulator.cpp \
+    batchmain.cpp
+
+HEADERS += batchrenderer.h \
+    passaccumulator.h
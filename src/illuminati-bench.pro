@@ -0,0 +1,11 @@
+QT -= core gui
+TARGET = photon-bench
+TEMPLATE = app
+
+# Stage benchmarks over the scenes in data-files/scene, see benchmain.cpp
+
+include(illuminati.pri)
+
+DEFINES += ILLUMINATI_BENCH
+
+SOURCES += benchmain.cpp
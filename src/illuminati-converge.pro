@@ -0,0 +1,14 @@
+QT -= core gui
+TARGET = photon-converge
+TEMPLATE = app
+
+# Error over time against a reference render, see convergemain.cpp
+
+include(illuminati.pri)
+
+DEFINES += ILLUMINATI_CONVERGE
+
+SOURCES += batchrenderer.cpp \
+    convergemain.cpp
+
+HEADERS += batchrenderer.h
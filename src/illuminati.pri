@@ -0,0 +1,110 @@
+# Sources and build settings shared by the app and the batch renderer
+
+# G3D_PATH - absolute path to G3D Library
+
+G3D_PATH = $$(G3D_PATH)
+
+isEmpty(G3D_PATH) {
+    # default sunlab path
+    G3D_PATH = /contrib/projects/g3d10/G3D10
+}
+
+# convert relative paths and sanitize
+# G3D_PATH = $$absolute_path($${G3D_PATH})
+# G3D_PATH = $$system_path($${G3D_PATH})
+
+message("G3D Path : " $${G3D_PATH})
+
+SOURCES += world.cpp \
+    photonscatter.cpp \
+    photonbeamette.cpp \
+    indphotonscatter.cpp \
+    dirphotonscatter.cpp \
+    indrenderer.cpp \
+    utils.cpp \
+    emitter.cpp \
+    aliastable.cpp \
+    splinestore.cpp \
+    beamstore.cpp \
+    beammap.cpp \
+    beambvh.cpp \
+    beamgrid.cpp \
+    pcgrandom.cpp \
+    photonsettings.cpp \
+    threadpool.cpp \
+    checkpoint.cpp \
+    splatring.cpp \
+    canvastexture.cpp \
+    beamsplatter.cpp \
+    beamculler.cpp \
+    splatpass.cpp \
+    scenecache.cpp \
+    renderstats.cpp
+
+HEADERS += world.h \
+    photonscatter.h \
+    photonbeamette.h \
+    indphotonscatter.h \
+    dirphotonscatter.h \
+    medium.h \
+    indrenderer.h \
+    utils.h \
+    photonsettings.h \
+    emitter.h \
+    aliastable.h \
+    splinestore.h \
+    beamstore.h \
+    beammap.h \
+    beambvh.h \
+    beamgrid.h \
+    pcgrandom.h \
+    samplecontext.h \
+    threadpool.h \
+    checkpoint.h \
+    splatvertex.h \
+    splatring.h \
+    canvastexture.h \
+    beamsplatter.h \
+    beamculler.h \
+    splatpass.h \
+    scenecache.h \
+    renderstats.h
+
+# qmake CONFIG+=stats writes per-pass counters, see renderstats.h
+stats: DEFINES += ILLUMINATI_STATS
+
+INCLUDEPATH += $${G3D_PATH}/build/include \
+            += $${G3D_PATH}/tbb/include
+
+LIBS += \
+    -L$${G3D_PATH}/build/lib \
+    -lGLG3D \
+    -lG3D \
+    -lassimp \
+    -lglfw \
+    -lXrandr \
+    -lGLU \
+    -lX11 \
+    -lfreeimage \
+    -lzip \
+    -lz \
+    -lGL \
+    -lpthread \
+    -lXi \
+    -lXxf86vm \
+    -lrt \
+    -lenet \
+    -ltbb \
+    -lglew \
+    -lXcursor
+
+QMAKE_CXXFLAGS += -std=c++14 -msse4.1
+
+QMAKE_CXXFLAGS_RELEASE -= -O2
+QMAKE_CXXFLAGS_RELEASE += -O3 -fno-strict-aliasing
+QMAKE_CXXFLAGS_WARN_ON -= -Wall
+QMAKE_CXXFLAGS_WARN_ON += -Waddress -Warray-bounds -Wc++0x-compat -Wchar-subscripts -Wformat\
+                          -Wmain -Wmissing-braces -Wparentheses -Wreorder -Wreturn-type \
+                          -Wsequence-point -Wsign-compare -Wstrict-aliasing -Wstrict-overflow=1 -Wswitch \
+                          -Wtrigraphs -Wuninitialized -Wunused-label -Wunused-variable \
+                          -Wvolatile-register-var -Wno-extra
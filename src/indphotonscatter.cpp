@@ -1,35 +1,270 @@
 #include "indphotonscatter.h"
 
+// Spaces out the worker seeds (golden ratio increment)
+static const uint32 SEED_STRIDE = 0x9E3779B9;
+
 IndPhotonScatter::IndPhotonScatter(World * world, shared_ptr<PhotonSettings> settings)
     : PhotonScatter(world, settings),
-      m_KDTreeBeams(std::make_shared<G3D::KDTree<PhotonBeamette>>())
+      m_map(std::make_shared<BeamMap>()),
+      m_frontMap(std::make_shared<BeamMap>()),
+      m_workload(0),
+      m_refreshCursor(0),
+      m_deltaRecorded(false),
+      m_deltaBehind(false),
+      m_refreshing(false),
+      m_refreshStop(false),
+      m_refreshTime(0.0),
+      m_scatterTime(0.0),
+      m_buildTime(0.0)
+{
+    // Each worker owns a random stream derived from the scatter seed, so a pass
+    // is reproducible for a given seed and thread count.
+    int numWorkers = max(1, m_PSettings->numScatterThreads);
+    for (int i = 0; i < numWorkers; ++i)
+    {
+        uint32 seed = m_PSettings->scatterSeedForPass(1) + SEED_STRIDE * (i + 1);
+        m_workers.append(shared_ptr<IndPhotonScatter>(new IndPhotonScatter(world, settings, seed)));
+    }
+
+    // The workers scatter every pass, so keep their threads around rather
+    // than starting new ones each time. They aren't pinned, even when the
+    // render threads are.
+    if (numWorkers > 1)
+    {
+        m_pool.reset(new ThreadPool(ThreadPool::Callback(), numWorkers, Array<int>(), 1));
+    }
+}
+
+IndPhotonScatter::IndPhotonScatter(World * world, shared_ptr<PhotonSettings> settings, uint32 seed)
+    : PhotonScatter(world, settings, seed),
+      m_workload(0),
+      m_refreshCursor(0),
+      m_deltaRecorded(false),
+      m_deltaBehind(false),
+      m_refreshing(false),
+      m_refreshStop(false),
+      m_refreshTime(0.0),
+      m_scatterTime(0.0),
+      m_buildTime(0.0)
 {
 }
 
 IndPhotonScatter::~IndPhotonScatter()
 {
+    if (!m_refreshThread) {
+        return;
+    }
+
+    // Lets a refresh in progress finish first
+    {
+        std::lock_guard<std::mutex> lock(m_refreshMutex);
+        m_refreshStop = true;
+    }
+    m_refreshCond.notify_all();
+    m_refreshThread->waitForCompletion();
+}
+
+void IndPhotonScatter::reseed(int firstPass)
+{
+    uint32 base = m_PSettings->scatterSeedForPass(firstPass);
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        m_workers[i]->m_random.reset(base + SEED_STRIDE * (i + 1), false);
+    }
 }
 
 void IndPhotonScatter::preprocess()
 {
-    Array<PhotonBeamette> tempBeamettes = Array<PhotonBeamette>();
-    Array<PhotonBeamette> newBeams;
+    RealTime start = System::time();
+    scatterPaths(m_PSettings->numBeamettesInDir);
+    RealTime scattered = System::time();
+
+    // Merge in worker order so the map contents don't depend on scheduling
+    m_paths.fastClear();
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        const IndPhotonScatter &worker = *m_workers[i];
+        for (int p = 0; p + 1 < worker.m_pathStart.size(); ++p)
+        {
+            int first = worker.m_pathStart[p];
+            m_paths.next().fastClear();
+            m_map->insert(worker.m_output, first, worker.m_pathStart[p + 1] - first, m_paths.last());
+        }
+    }
+    m_refreshCursor = 0;
+
+    m_map->balance();
+
+    m_scatterTime = scattered - start;
+    m_buildTime = System::time() - scattered;
+}
+
+void IndPhotonScatter::refreshBeams()
+{
+    int numPaths = m_PSettings->numBeamettesInDir;
+    int numRefresh = iCeil(m_PSettings->beamRefreshFraction * numPaths);
+
+    if (numRefresh >= numPaths || m_paths.size() != numPaths)
+    {
+        rebuild();
+        return;
+    }
+
+    // Start from the latest map, m_paths refers to its slots
+    bool replayed = catchUp();
+
+    m_deltaRemoved.fastClear();
+    m_deltaRemoveCount.fastClear();
+    m_deltaRecorded = true;
+
+    if (numRefresh <= 0) {
+        if (replayed) {
+            m_map->balance();
+        }
+        return;
+    }
+
+    scatterPaths(numRefresh);
+
+    // Replace the oldest paths with the new ones, in place
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        const IndPhotonScatter &worker = *m_workers[i];
+        for (int p = 0; p + 1 < worker.m_pathStart.size(); ++p)
+        {
+            Array<int> &slots = m_paths[m_refreshCursor];
+            for (int b = 0; b < slots.size(); ++b)
+            {
+                m_map->remove(slots[b]);
+                m_deltaRemoved.append(slots[b]);
+            }
+            m_deltaRemoveCount.append(slots.size());
+
+            // The removed slots are reused first, so the store doesn't grow
+            slots.fastClear();
+            int first = worker.m_pathStart[p];
+            m_map->insert(worker.m_output, first, worker.m_pathStart[p + 1] - first, slots);
+
+            m_refreshCursor = (m_refreshCursor + 1) % numPaths;
+        }
+    }
+
+    // New beams aren't in the hierarchy until it is rebuilt, and until then
+    // every gather tests them one by one. The build is a median split over
+    // packed data, so just redo it every pass.
+    m_map->balance();
+}
+
+bool IndPhotonScatter::catchUp()
+{
+    if (!m_deltaBehind)
+    {
+        *m_map = *m_frontMap;
+        m_map->clearGrid();
+        return false;
+    }
+    m_deltaBehind = false;
+
+    // A refresh that shot nothing left the workers' output of an older one
+    if (m_deltaRemoveCount.size() == 0)
+    {
+        m_map->clearGrid();
+        return false;
+    }
+
+    // Free slots are reused last in, first out, so the same removals and
+    // inserts in the same order land the beams in the same slots as they
+    // did in the published map. The hierarchy doesn't affect that, it is
+    // rebuilt once the new paths are in.
+    Array<int> slots;
+    int removed = 0;
+    int path = 0;
+    for (int i = 0; i < m_workers.size(); ++i)
+    {
+        const IndPhotonScatter &worker = *m_workers[i];
+        for (int p = 0; p + 1 < worker.m_pathStart.size(); ++p, ++path)
+        {
+            for (int b = 0; b < m_deltaRemoveCount[path]; ++b)
+            {
+                m_map->remove(m_deltaRemoved[removed++]);
+            }
+
+            slots.fastClear();
+            int first = worker.m_pathStart[p];
+            m_map->insert(worker.m_output, first, worker.m_pathStart[p + 1] - first, slots);
+        }
+    }
+    m_map->clearGrid();
+
+    debugAssertM(m_map->store().size() == m_frontMap->store().size() && m_map->size() == m_frontMap->size(),
+                 "Replaying the last refresh didn't reproduce the published map");
+    return true;
+}
+
+void IndPhotonScatter::scatterPaths(int count)
+{
+    int numWorkers = m_workers.size();
+
+    // Split the paths evenly between the workers
+    for (int i = 0; i < numWorkers; ++i)
+    {
+        m_workers[i]->m_workload = count / numWorkers + (i < count % numWorkers ? 1 : 0);
+    }
+
+    if (numWorkers == 1)
+    {
+        m_workers[0]->scatterWorkload();
+    }
+    else
+    {
+        m_pool->run(numWorkers, 1, [this](int x, int) { m_workers[x]->scatterWorkload(); });
+    }
+}
+
+void IndPhotonScatter::scatterWorkload()
+{
+    m_output.clear();
+    m_pathStart.fastClear();
+
+    if (m_PSettings->useWavefrontScatter)
+    {
+        // Sort the wavefront's beams back out into their paths (counting sort)
+        BeamStore beams;
+        Array<int> beamPaths;
+        shootRaysWavefront(beams, beamPaths, m_workload, m_PSettings->numBeamettesInDir, 0);
+
+        m_pathStart.resize(m_workload + 1);
+        for (int i = 0; i < m_pathStart.size(); ++i)
+            m_pathStart[i] = 0;
+        for (int b = 0; b < beamPaths.size(); ++b)
+            ++m_pathStart[beamPaths[b] + 1];
+        for (int i = 1; i < m_pathStart.size(); ++i)
+            m_pathStart[i] += m_pathStart[i - 1];
+
+        Array<int> next = m_pathStart;
+        Array<int> order;
+        order.resize(beams.size());
+        for (int b = 0; b < beamPaths.size(); ++b)
+            order[next[beamPaths[b]]++] = b;
+        for (int b = 0; b < order.size(); ++b)
+            m_output.append(beams, order[b], 1);
+        return;
+    }
+
     // Send out a beam, recursively bounce it around, and then store it in our beams array.
-    for (int i=0; i<m_PSettings->numBeamettesInDir; i++)
+    for (int i = 0; i < m_workload; i++)
     {
+        m_pathStart.append(m_output.size());
         // we won't start storing rays until after initial bounce - initial bounce = 0
-        shootRay(newBeams, m_PSettings->numBeamettesInDir, 0);
-        tempBeamettes.append(newBeams);
-//        printf("\rBuilding indirect photon beamette map ... %.2f%%", 100.f * i / m_PSettings->numBeamettesInDir);
+        // Weighted by the total beam count, not this worker's share.
+        shootRay(m_output, m_PSettings->numBeamettesInDir, 0);
     }
-
-//    printf("\rBuilding indirect photon beamette map ... done       \n");
-    m_KDTreeBeams->insert(tempBeamettes);
+    m_pathStart.append(m_output.size());
 }
 
 void IndPhotonScatter::phaseFxn(Vector3 wi, Vector3 &wo)
 {
-    wo = Vector3::cosHemiRandom(-wi);
+    wo = Vector3::cosHemiRandom(-wi, m_random);
 }
 
 float IndPhotonScatter::getRayMarchDist()
@@ -37,15 +272,76 @@ float IndPhotonScatter::getRayMarchDist()
     return m_PSettings->dist;
 }
 
-std::shared_ptr<G3D::KDTree<PhotonBeamette>> IndPhotonScatter::getBeams()
+std::shared_ptr<BeamMap> IndPhotonScatter::getBeams()
 {
-    return m_KDTreeBeams;
+    return m_frontMap;
 }
 
 void IndPhotonScatter::makeBeams()
 {
-    m_KDTreeBeams->clear();
+    rebuild();
+    swapBeams();
+}
+
+void IndPhotonScatter::rebuild()
+{
+    m_deltaRecorded = false;
+    m_deltaBehind = false;
+    m_map->clear();
     preprocess();
 }
 
+void IndPhotonScatter::startRefresh()
+{
+    if (!m_refreshThread) {
+        m_refreshThread = Thread::create("IndPhotonScatter refresh", refreshMain, this);
+        m_refreshThread->start();
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_refreshMutex);
+        debugAssertM(!m_refreshing, "A refresh is already running");
+        m_refreshing = true;
+    }
+    m_refreshCond.notify_all();
+}
+
+void IndPhotonScatter::waitRefresh()
+{
+    std::unique_lock<std::mutex> lock(m_refreshMutex);
+    m_refreshCond.wait(lock, [this] { return !m_refreshing; });
+}
+
+void IndPhotonScatter::refreshMain(void *arg)
+{
+    IndPhotonScatter *self = (IndPhotonScatter*)arg;
+
+    std::unique_lock<std::mutex> lock(self->m_refreshMutex);
+    while (true)
+    {
+        self->m_refreshCond.wait(lock, [self] { return self->m_refreshStop || self->m_refreshing; });
+        if (self->m_refreshStop) {
+            return;
+        }
+
+        // Only this thread touches the back buffer until m_refreshing is cleared
+        lock.unlock();
+        RealTime start = System::time();
+        self->refreshBeams();
+        RealTime elapsed = System::time() - start;
+        lock.lock();
+
+        self->m_refreshTime = elapsed;
+        self->m_refreshing = false;
+        self->m_refreshCond.notify_all();
+    }
+}
+
+void IndPhotonScatter::swapBeams()
+{
+    std::swap(m_map, m_frontMap);
 
+    // The new back buffer was the front one before the refresh just published
+    m_deltaBehind = m_deltaRecorded;
+    m_deltaRecorded = false;
+}
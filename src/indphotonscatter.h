@@ -1,7 +1,30 @@
 #ifndef INDPHOTONSCATTER_H
 #define INDPHOTONSCATTER_H
 #include "photonscatter.h"
+#include "beammap.h"
+#include "threadpool.h"
+#include <mutex>
+#include <condition_variable>
 
+/**
+ * Scatters the indirect photon beams and keeps them in a BeamMap for gathering.
+ *
+ * The beams are kept grouped by the emitted beam (path) that stored them, one
+ * slot per emitted beam. refreshBeams() re-shoots only a fraction of the
+ * paths each pass, oldest first, like a rolling reservoir, and updates the
+ * map in place. The population stays at numBeamettesInDir paths, so gathers
+ * are weighted the same way as after a full rebuild.
+ *
+ * The map is double buffered: refreshBeams() builds the next map in a back
+ * buffer while renderers gather from the one getBeams() returned, and
+ * swapBeams() publishes it. The back buffer is then a refresh behind, and
+ * the next refreshBeams() catches it up by replaying the removals and
+ * inserts of that refresh rather than copying the whole published map.
+ *
+ * startRefresh() runs refreshBeams() on a thread of its own, so the next
+ * map is built while a pass gathers from the current one. The thread is
+ * started by the first call and then sleeps between refreshes.
+ */
 class IndPhotonScatter
     :public PhotonScatter
 {
@@ -9,7 +32,7 @@ public:
     IndPhotonScatter(World * world, shared_ptr<PhotonSettings> settings);
     ~IndPhotonScatter();
 
-    /** Scatters photon beams and stores them in the KdTree */
+    /** Scatters photon beams on all workers and stores them in the beam map */
     void preprocess();
 
     /** Given input direction wi, generates output direction
@@ -19,17 +42,91 @@ public:
     /** Distance to ray march. */
     float getRayMarchDist();
 
-    /** Returns beams from KdTree. */
-    std::shared_ptr<G3D::KDTree<PhotonBeamette>> getBeams();
+    /** Returns the published beam map. */
+    std::shared_ptr<BeamMap> getBeams();
 
-    /** Clears KdTree, scatters beams, and stores them in the KdTree. */
+    /** Scatters a new set of beams and publishes their map. */
     void makeBeams();
 
+    /** Builds the next map in the back buffer, re-shooting beamRefreshFraction
+     *  of the paths and replacing the oldest ones. Rebuilds from scratch for a
+     *  fraction of 1 or when the beam count has changed. Doesn't touch the
+     *  published map, so it can run while that map is being gathered from. */
+    void refreshBeams();
+
+    /** Publishes the map built by the last refreshBeams() */
+    void swapBeams();
+
+    /** Starts refreshBeams() on the refresh thread and returns */
+    void startRefresh();
+
+    /** Waits for the refresh startRefresh() started, if any */
+    void waitRefresh();
+
+    /** Seconds the last refresh on the refresh thread took */
+    double refreshTime() const { return m_refreshTime; }
+
+    /** Restarts the workers' random streams for a render that starts at
+     *  the given (1-based) pass, see PhotonSettings::scatterSeedForPass */
+    void reseed(int firstPass);
+
+    /** Seconds the last full build spent scattering, and inserting into and balancing the map */
+    double scatterTime() const { return m_scatterTime; }
+    double buildTime() const { return m_buildTime; }
+
 protected:
 
-    std::shared_ptr<G3D::KDTree<PhotonBeamette>> m_KDTreeBeams;
+    /** Creates a scatter worker with its own random stream. Workers have no workers of their own. */
+    IndPhotonScatter(World * world, shared_ptr<PhotonSettings> settings, uint32 seed);
+
+    /** Shoots count paths, split between the workers. The beams of each path end up
+     *  in the workers' m_output, in worker order, delimited by m_pathStart. */
+    void scatterPaths(int count);
+
+    /** Shoots m_workload paths into m_output. Called on the worker's thread. */
+    void scatterWorkload();
+
+    /** Clears the back buffer and scatters a whole new set of beams into it */
+    void rebuild();
+
+    /** Refresh thread entry point, arg is the scatterer */
+    static void refreshMain(void *arg);
+
+    /** Brings the back buffer up to the published map, by replaying the last
+     *  refresh if that is what it is missing, or else by copying. Returns
+     *  whether beams were replayed, which leaves the hierarchy unbalanced. */
+    bool catchUp();
+
+    std::shared_ptr<BeamMap> m_map;         // back buffer, written by preprocess() and refreshBeams()
+    std::shared_ptr<BeamMap> m_frontMap;    // published map
 
 private:
+    Array<shared_ptr<IndPhotonScatter>> m_workers;
+    std::unique_ptr<ThreadPool>         m_pool;     // runs the workers, one task each, when there are several
+    int                                 m_workload; // paths this worker shoots per pass
+    BeamStore                           m_output;    // beams this worker shot in the last pass, by path
+    Array<int>                          m_pathStart; // first beam of each path in m_output, plus the end
+
+    Array<Array<int>>                   m_paths;          // slots of the beams in the latest map, by path
+    int                                 m_refreshCursor;  // oldest path, replaced next
+
+    // What the last refresh did, so the other buffer can be brought up to
+    // date: the slots it removed, how many for each new path, and the new
+    // beams themselves, which are still in the workers' m_output
+    Array<int>                          m_deltaRemoved;
+    Array<int>                          m_deltaRemoveCount;
+    bool                                m_deltaRecorded;  // the back buffer was last built by a refresh
+    bool                                m_deltaBehind;    // the back buffer is the delta behind the front one
+
+    shared_ptr<Thread>                  m_refreshThread;
+    std::mutex                          m_refreshMutex;
+    std::condition_variable             m_refreshCond;
+    bool                                m_refreshing;     // a refresh was started and hasn't finished
+    bool                                m_refreshStop;
+    double                              m_refreshTime;
+
+    double                              m_scatterTime;
+    double                              m_buildTime;
 };
 
 #endif // INDPHOTONSCATTER_H
@@ -1,4 +1,28 @@
 #include "indrenderer.h"
+#include "renderstats.h"
+
+/** Sums the radiance the beams near a surface point scatter towards the viewer,
+  * using cone() as kernel */
+struct GatherVisitor
+{
+    const BeamStore &           beams;
+    const shared_ptr<Surfel> &  surf;
+    Vector3                     wo;
+    float                       gatherRadius;
+    Radiance3                   rad;
+
+    GatherVisitor(const BeamStore &b, const shared_ptr<Surfel> &s, Vector3 w, float r)
+        : beams(b), surf(s), wo(w), gatherRadius(r) {}
+
+    void operator()(int b, float dist)
+    {
+        Vector3 wi = beams.end(b) - beams.start(b);
+        Radiance3 scatter = surf->finiteScatteringDensity(wi, wo);
+
+        float c = std::fmax(Utils::cone(dist, gatherRadius), 0.0);
+        rad += beams.power(b) * c * scatter;
+    }
+};
 
 IndRenderer::IndRenderer(World* world, shared_ptr<PhotonSettings> settings):
     m_world(world),
@@ -11,7 +35,7 @@ IndRenderer::~IndRenderer()
 {
 }
 
-Radiance3 IndRenderer::direct(std::shared_ptr<Surfel> surf, Vector3 wo)
+Radiance3 IndRenderer::direct(std::shared_ptr<Surfel> surf, Vector3 wo, SampleContext &ctx)
 {
     Radiance3 rad;
 
@@ -22,9 +46,10 @@ Radiance3 IndRenderer::direct(std::shared_ptr<Surfel> surf, Vector3 wo)
 
     for (int i = 0; i < m_PSettings->directSamples; ++i)
     {
-        m_world->emissivePoint(m_random, light, P_light, area, id);
+        m_world->emissivePoint(ctx.random, light, P_light, area, id);
 
         if (id >= 0){ // If spline light, don't render direct illum from area light
+            STATS_COUNT(SPLINE_LIGHTS_SKIPPED, 1);
             continue;
         }
 
@@ -47,7 +72,7 @@ Radiance3 IndRenderer::direct(std::shared_ptr<Surfel> surf, Vector3 wo)
     return rad / m_PSettings->directSamples;
 }
 
-Radiance3 IndRenderer::impulse(std::shared_ptr<Surfel> surf, Vector3 wo, int depth)
+Radiance3 IndRenderer::impulse(std::shared_ptr<Surfel> surf, Vector3 wo, int depth, SampleContext &ctx)
 {
     if (!--depth)
         return Radiance3::zero();
@@ -61,13 +86,13 @@ Radiance3 IndRenderer::impulse(std::shared_ptr<Surfel> surf, Vector3 wo, int dep
         Ray ray(surf->position, imp[i].direction);
         Utils::bump(ray, surf);
 
-        rad += imp[i].magnitude * trace(ray, depth);
+        rad += imp[i].magnitude * trace(ray, depth, ctx);
     }
 
     return rad;
 }
 
-Radiance3 IndRenderer::diffuse(std::shared_ptr<Surfel> surf, Vector3 wo, int depth)
+Radiance3 IndRenderer::diffuse(std::shared_ptr<Surfel> surf, Vector3 wo, int depth, SampleContext &ctx)
 {
     // In line with the path demo, ignore diffuse interrfelection for specular
     // surfaces.
@@ -87,12 +112,12 @@ Radiance3 IndRenderer::diffuse(std::shared_ptr<Surfel> surf, Vector3 wo, int dep
             Vector3 wOutGather = Vector3(0.f, 0.f, 0.f); // ray leaving original intersect point
             float probabilityHint = 0.f;
             Color3 weight = Color3(1.0);
-            surf->scatter(PathDirection::SOURCE_TO_EYE, wInGather, false, m_random, weight, wOutGather, probabilityHint);
+            surf->scatter(PathDirection::SOURCE_TO_EYE, wInGather, false, ctx.random, weight, wOutGather, probabilityHint);
 
             Vector3 offsetPos = Utils::bump(surf->position, wOutGather, surf->shadingNormal);
             Ray gatherRay = Ray(offsetPos, wOutGather); // bumped ray leaving original intersect point
             int newDepth = depth - 1;
-            Radiance3 gatherColor = trace(gatherRay, newDepth).clamp(0.f, 1.f);
+            Radiance3 gatherColor = trace(gatherRay, newDepth, ctx).clamp(0.f, 1.f);
             Radiance3 currColor = pif() * gatherColor * weight;
             rad += currColor;
         }
@@ -101,30 +126,25 @@ Radiance3 IndRenderer::diffuse(std::shared_ptr<Surfel> surf, Vector3 wo, int dep
     // Else, do normal diffuse calcualation
     }else{
         // Iterate through photon beams in a sphere of radius GATHER_RADIUS
-        // Using cone() as kernel
-        Array<PhotonBeamette> beamettes;
-
-        m_beams->getIntersectingMembers(Sphere(surf->position, m_gatherRadius), beamettes);
-        for (int i=0; i<beamettes.size(); i++){
-
-
-            PhotonBeamette beam = beamettes[i];
-            Vector3 closestPt = Utils::closestPointOnLine(surf->position, beam.m_start, beam.m_end);
-
-            float dist = Vector3(surf->position - closestPt).length();
-
-            Vector3 wi =  beam.m_end - beam.m_start;
-            Radiance3 scatter = surf->finiteScatteringDensity(wi, wo.direction());
-
-            float c = std::fmax(Utils::cone(dist, m_gatherRadius), 0.0);
-            rad += beam.m_power * c * scatter/fmin(m_PSettings->numBeamettesInDir, m_beams->size());
-//            rad += beam.m_power * c * scatter;
-        }
+        GatherVisitor gather(m_beams->store(), surf, wo.direction(), m_gatherRadius);
+
+#ifdef ILLUMINATI_STATS
+        BeamQueryStats stats;
+        m_beams->forEachIntersecting(surf->position, m_gatherRadius, gather, &stats);
+
+        STATS_COUNT(GATHERS, 1);
+        STATS_COUNT(GATHER_NODES_VISITED, stats.nodesVisited);
+        STATS_COUNT(GATHER_BEAMS_TESTED, stats.beamsTested);
+        STATS_COUNT(GATHER_BEAMS_RETURNED, stats.beamsHit);
+#else
+        m_beams->forEachIntersecting(surf->position, m_gatherRadius, gather);
+#endif
+        rad += gather.rad / fmin(m_PSettings->numBeamettesInDir, m_beams->size());
     }
     return rad;
 }
 
-Radiance3 IndRenderer::trace(const Ray &ray, int depth)
+Radiance3 IndRenderer::trace(const Ray &ray, int depth, SampleContext &ctx)
 {
     Radiance3 final;
 
@@ -139,9 +159,9 @@ Radiance3 IndRenderer::trace(const Ray &ray, int depth)
         Vector3 wo = -ray.direction();
 
         Radiance3 surf_radiance = surf->emittedRadiance(wo)
-               + direct(surf, wo)
-               + diffuse(surf, wo, depth)
-               + impulse(surf, wo, depth);
+               + direct(surf, wo, ctx)
+               + diffuse(surf, wo, depth, ctx)
+               + impulse(surf, wo, depth, ctx);
         Radiance3 fogCooef = Utils::exp(dist, Radiance3(m_PSettings->attenuation));
 //        surf_radiance = surf_radiance*fogCooef.r + (1. - fogCooef.r)*Color3::white()*0.2;
 
@@ -151,13 +171,39 @@ Radiance3 IndRenderer::trace(const Ray &ray, int depth)
 }
 
 
-void IndRenderer::setBeams(std::shared_ptr<G3D::KDTree<PhotonBeamette>> beams)
+void IndRenderer::setBeams(std::shared_ptr<BeamMap> beams)
 {
     m_beams = beams;
 }
 
+BeamQueryStats IndRenderer::gatherTotals()
+{
+    BeamQueryStats stats;
+#ifdef ILLUMINATI_STATS
+    stats.queries = RenderStats::total(RenderStats::GATHERS);
+    stats.nodesVisited = RenderStats::total(RenderStats::GATHER_NODES_VISITED);
+    stats.beamsTested = RenderStats::total(RenderStats::GATHER_BEAMS_TESTED);
+    stats.beamsHit = RenderStats::total(RenderStats::GATHER_BEAMS_RETURNED);
+#endif
+    return stats;
+}
+
 void IndRenderer::setGatherRadius(float rad)
 {
     m_gatherRadius = rad;
+
+    // The grid's cells are sized to the radius, so rebuild it for each one
+    if (!m_beams) {
+        return;
+    }
+    if (m_PSettings->useBeamGrid) {
+        // The grid is rebuilt every pass, so its threads are kept around
+        if (!m_gridPool && m_PSettings->numScatterThreads > 1) {
+            m_gridPool.reset(new ThreadPool(ThreadPool::Callback(), m_PSettings->numScatterThreads, Array<int>(), 1));
+        }
+        m_beams->buildGrid(m_gatherRadius, m_gridPool.get());
+    } else {
+        m_beams->clearGrid();
+    }
 }
 
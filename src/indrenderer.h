@@ -3,6 +3,9 @@
 #include <G3D/G3DAll.h>
 #include "world.h"
 #include "photonscatter.h"
+#include "beammap.h"
+#include "threadpool.h"
+#include "samplecontext.h"
 
 /**
  * @brief The renderer class. Takes in a BBH type and a World type.
@@ -18,16 +21,18 @@ public:
       *
       * @param surf The surface point receiving illumination
       * @param wo   Points towards the viewer viewing the surface point
+      * @param ctx  The sample being rendered
       */
-    Radiance3 direct(std::shared_ptr<Surfel> surf, Vector3 wo);
+    Radiance3 direct(std::shared_ptr<Surfel> surf, Vector3 wo, SampleContext &ctx);
 
     /** Computes the indirect illumination approaching the given surface point
       * via the impulse directions of the surface's BSDF
       *
       * @param surf The surface point receiving illumination
       * @param wo   Points towards the viewer viewing the surface point
+      * @param ctx  The sample being rendered
       */
-    Radiance3 impulse(std::shared_ptr<Surfel> surf, Vector3 wo, int depth);
+    Radiance3 impulse(std::shared_ptr<Surfel> surf, Vector3 wo, int depth, SampleContext &ctx);
 
     /**
       *
@@ -36,26 +41,32 @@ public:
       *
       * @param surf The surface point receiving illumination
       * @param wo   Points towards the viewer viewing the surface point
+      * @param ctx  The sample being rendered
       */
-    Radiance3 diffuse(std::shared_ptr<Surfel> surf, Vector3 wo, int depth);
+    Radiance3 diffuse(std::shared_ptr<Surfel> surf, Vector3 wo, int depth, SampleContext &ctx);
     /** Gathers emissive, direct, impulse and diffuse (photon map) illumination
-      * from the point under the given ray
+      * from the point under the given ray. All random numbers come from ctx,
+      * so concurrent calls with their own contexts don't interfere.
       */
-    Radiance3 trace(const Ray &ray, int depth);
+    Radiance3 trace(const Ray &ray, int depth, SampleContext &ctx);
 
       /**
       Sets the photon beam array that will be used to render the scene.
       */
-    void setBeams(std::shared_ptr<G3D::KDTree<PhotonBeamette>> beams);
+    void setBeams(std::shared_ptr<BeamMap> beams);
 
     void setGatherRadius(float rad);
 
+    /** Work done by the beam map queries of diffuse() of every renderer so
+      * far, as counted by RenderStats. All zero unless it is built in. */
+    static BeamQueryStats gatherTotals();
+
 private:
 
     World*  m_world;
-    Random  m_random;   // Random number generator
     shared_ptr<PhotonSettings> m_PSettings; // Settings
-    std::shared_ptr<G3D::KDTree<PhotonBeamette>> m_beams;
+    std::shared_ptr<BeamMap> m_beams;
+    std::unique_ptr<ThreadPool> m_gridPool; // builds the beam grid, once it is first needed
 
     float m_gatherRadius;
 
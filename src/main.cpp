@@ -7,11 +7,68 @@
 
 G3D_START_AT_MAIN();
 
+static void printUsage(const char *name)
+{
+    printf("Usage: %s [--threads N] [--affinity CPUS] [--checkpoint FILE] [--scene-cache DIR]\n"
+           "  --threads N       number of render threads (default: one per usable CPU)\n"
+           "  --affinity CPUS   CPUs to pin the render threads to, e.g. 0-7,16-23\n"
+           "                    (default: not pinned)\n"
+           "  --checkpoint FILE save renders to FILE as they go, and resume the one in it\n"
+           "  --scene-cache DIR cache parsed scenes in DIR, to load faster next time\n", name);
+}
+
 int main(int argc, const char *argv[])
 {
+    int numThreads = 0;
+    Array<int> cpus;
+    String checkpointFile;
+    String sceneCache;
+
+    for (int i = 1; i < argc; ++i)
+    {
+        String arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc)
+        {
+            numThreads = atoi(argv[++i]);
+            if (numThreads <= 0) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--affinity" && i + 1 < argc)
+        {
+            if (!ThreadPool::parseCpuList(argv[++i], cpus)) {
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if (arg == "--checkpoint" && i + 1 < argc)
+        {
+            checkpointFile = argv[++i];
+        }
+        else if (arg == "--scene-cache" && i + 1 < argc)
+        {
+            sceneCache = argv[++i];
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+
     GApp::Settings s;
     s.window.caption = "Photon Beams";
     s.dataDir = G3D_PATH "/../data10/common";
 
-    return App(s).run();
+    App app(s);
+    if (numThreads > 0)
+        app.photonSettings()->numRenderThreads = numThreads;
+    else if (cpus.size() > 0)
+        app.photonSettings()->numRenderThreads = cpus.size();
+    app.photonSettings()->renderAffinity = cpus;
+    app.setCheckpointFile(checkpointFile);
+    app.setSceneCache(sceneCache);
+
+    return app.run();
 }
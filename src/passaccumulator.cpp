@@ -0,0 +1,210 @@
+#include "passaccumulator.h"
+
+// "ILPA", then a format version
+static const uint32 MAGIC = 0x41504C49;
+// 3: passes normalized by their own gather radius, see Utils::cone
+static const uint32 VERSION = 3;
+
+PassAccumulator::PassAccumulator()
+    : m_width(0),
+      m_height(0),
+      m_gatherRadius(0.f),
+      m_minGatherRadius(0.f),
+      m_renderSeed(0),
+      m_scatterSeed(0),
+      m_numBeamettesInDir(0),
+      m_splatDirect(false)
+{
+}
+
+PassAccumulator::PassAccumulator(const Image3 &average, const Array<int> &passes,
+                                 const String &scene, const PhotonSettings &settings)
+    : m_width(average.width()),
+      m_height(average.height()),
+      m_scene(scene),
+      m_gatherRadius(settings.gatherRadius),
+      m_minGatherRadius(settings.minGatherRadius),
+      m_renderSeed(settings.renderSeed),
+      m_scatterSeed(settings.scatterSeed),
+      m_numBeamettesInDir(settings.numBeamettesInDir),
+      m_splatDirect(settings.splatDirect),
+      m_passes(passes)
+{
+    m_passes.sort();
+
+    float n = float(m_passes.size());
+    m_sum.resize(m_width * m_height);
+    for (int y = 0; y < m_height; ++y)
+        for (int x = 0; x < m_width; ++x)
+        {
+            m_sum[y * m_width + x] = average.get(x, y) * n;
+        }
+}
+
+bool PassAccumulator::save(const String &path) const
+{
+    BinaryOutput out(path, G3D_LITTLE_ENDIAN);
+    out.writeUInt32(MAGIC);
+    out.writeUInt32(VERSION);
+    out.writeInt32(m_width);
+    out.writeInt32(m_height);
+    out.writeString32(m_scene);
+    out.writeFloat32(m_gatherRadius);
+    out.writeFloat32(m_minGatherRadius);
+    out.writeUInt32(m_renderSeed);
+    out.writeUInt32(m_scatterSeed);
+    out.writeInt32(m_numBeamettesInDir);
+    out.writeUInt8(m_splatDirect ? 1 : 0);
+    out.writeInt32(m_passes.size());
+    for (int i = 0; i < m_passes.size(); ++i)
+    {
+        out.writeInt32(m_passes[i]);
+    }
+    for (int i = 0; i < m_sum.size(); ++i)
+    {
+        out.writeFloat32(m_sum[i].r);
+        out.writeFloat32(m_sum[i].g);
+        out.writeFloat32(m_sum[i].b);
+    }
+    out.commit();
+    return out.ok();
+}
+
+bool PassAccumulator::load(const String &path)
+{
+    if (!FileSystem::exists(path)) {
+        printf("%s does not exist\n", path.c_str());
+        return false;
+    }
+
+    BinaryInput in(path, G3D_LITTLE_ENDIAN);
+    if (in.getLength() < 8 || in.readUInt32() != MAGIC || in.readUInt32() != VERSION) {
+        printf("%s is not a partial render\n", path.c_str());
+        return false;
+    }
+
+    int width = in.readInt32();
+    int height = in.readInt32();
+    String scene = in.readString32();
+    float gatherRadius = in.readFloat32();
+    float minGatherRadius = in.readFloat32();
+    uint32 renderSeed = in.readUInt32();
+    uint32 scatterSeed = in.readUInt32();
+    int numBeamettesInDir = in.readInt32();
+    bool splatDirect = in.readUInt8() != 0;
+    int numPasses = in.readInt32();
+    if (width < 0 || height < 0 || numPasses < 0 ||
+        in.getLength() != in.getPosition() + int64(numPasses) * 4 + int64(width) * height * 12) {
+        printf("%s is truncated\n", path.c_str());
+        return false;
+    }
+
+    m_width = width;
+    m_height = height;
+    m_scene = scene;
+    m_gatherRadius = gatherRadius;
+    m_minGatherRadius = minGatherRadius;
+    m_renderSeed = renderSeed;
+    m_scatterSeed = scatterSeed;
+    m_numBeamettesInDir = numBeamettesInDir;
+    m_splatDirect = splatDirect;
+    m_passes.resize(numPasses);
+    for (int i = 0; i < numPasses; ++i)
+    {
+        m_passes[i] = in.readInt32();
+    }
+    m_passes.sort();
+    m_sum.resize(width * height);
+    for (int i = 0; i < m_sum.size(); ++i)
+    {
+        m_sum[i].r = in.readFloat32();
+        m_sum[i].g = in.readFloat32();
+        m_sum[i].b = in.readFloat32();
+    }
+    return true;
+}
+
+bool PassAccumulator::add(const PassAccumulator &other)
+{
+    if (m_passes.size() == 0) {
+        *this = other;
+        return true;
+    }
+    if (other.m_passes.size() == 0) {
+        return true;
+    }
+
+    if (other.m_width != m_width || other.m_height != m_height) {
+        printf("Partials of different sizes: %dx%d and %dx%d\n", m_width, m_height, other.m_width, other.m_height);
+        return false;
+    }
+    if (other.m_scene != m_scene) {
+        printf("Partials of different scenes: %s and %s\n", m_scene.c_str(), other.m_scene.c_str());
+        return false;
+    }
+    // The same pass numbers would mean different radii and seeds
+    if (other.m_gatherRadius != m_gatherRadius || other.m_minGatherRadius != m_minGatherRadius ||
+        other.m_renderSeed != m_renderSeed || other.m_scatterSeed != m_scatterSeed) {
+        printf("Partials of different renders: gatherRadius %g and %g (at least %g and %g), "
+               "renderSeed %u and %u, scatterSeed %u and %u\n",
+               m_gatherRadius, other.m_gatherRadius, m_minGatherRadius, other.m_minGatherRadius,
+               m_renderSeed, other.m_renderSeed, m_scatterSeed, other.m_scatterSeed);
+        return false;
+    }
+    // Or beams that aren't weighted alike
+    if (other.m_numBeamettesInDir != m_numBeamettesInDir || other.m_splatDirect != m_splatDirect) {
+        printf("Partials of different renders: numBeamettesInDir %d and %d, splatDirect %s and %s\n",
+               m_numBeamettesInDir, other.m_numBeamettesInDir,
+               m_splatDirect ? "true" : "false", other.m_splatDirect ? "true" : "false");
+        return false;
+    }
+
+    // Both lists are sorted
+    Array<int> merged;
+    int i = 0, j = 0;
+    while (i < m_passes.size() || j < other.m_passes.size())
+    {
+        if (j == other.m_passes.size() || (i < m_passes.size() && m_passes[i] < other.m_passes[j])) {
+            merged.append(m_passes[i++]);
+        } else if (i == m_passes.size() || other.m_passes[j] < m_passes[i]) {
+            merged.append(other.m_passes[j++]);
+        } else {
+            printf("Pass %d is in two partials\n", m_passes[i]);
+            return false;
+        }
+    }
+
+    m_passes = merged;
+    for (int p = 0; p < m_sum.size(); ++p)
+    {
+        m_sum[p] += other.m_sum[p];
+    }
+    return true;
+}
+
+Array<int> PassAccumulator::missingPasses() const
+{
+    Array<int> missing;
+    int next = 1;
+    for (int i = 0; i < m_passes.size(); ++i)
+    {
+        for (; next < m_passes[i]; ++next)
+        {
+            missing.append(next);
+        }
+        next = m_passes[i] + 1;
+    }
+    return missing;
+}
+
+shared_ptr<Image3> PassAccumulator::average() const
+{
+    shared_ptr<Image3> image = Image3::createEmpty(m_width, m_height);
+    float scale = (m_passes.size() > 0) ? 1.f / m_passes.size() : 0.f;
+    for (int y = 0; y < m_height; ++y)
+        for (int x = 0; x < m_width; ++x)
+        {
+            image->set(x, y, m_sum[y * m_width + x] * scale);
+        }
+    return image;
+}
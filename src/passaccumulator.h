@@ -0,0 +1,68 @@
+#ifndef PASSACCUMULATOR_H
+#define PASSACCUMULATOR_H
+#include <G3D/G3DAll.h>
+
+#include "photonsettings.h"
+
+/** The summed samples of a set of progressive passes, for splitting one
+  * render's passes across processes and merging them afterwards.
+  *
+  * Every pass traces each pixel once, so a partial is the per-pixel sum of
+  * its passes plus the list of (1-based, global) pass numbers it holds.
+  * A pass's number fixes its seeds and its gather radius
+  * (PhotonSettings::gatherRadiusForPass), so partials merge by adding sums
+  * as long as no pass is in two of them. Each pass then weighs the same as
+  * in the running average of a single process render.
+  *
+  * Like a Checkpoint, a partial keeps what else makes its passes those of
+  * one render: the scene, the seeds, the radius schedule, the beam count
+  * and whether the direct beams were splatted. Partials that differ in any
+  * of these don't merge.
+  */
+class PassAccumulator
+{
+public:
+    PassAccumulator();
+
+    /** From the running average of a render of scene with settings over
+      * the given passes */
+    PassAccumulator(const Image3 &average, const Array<int> &passes,
+                    const String &scene, const PhotonSettings &settings);
+
+    /** Writes the partial to a file. Returns false if it couldn't. */
+    bool save(const String &path) const;
+
+    /** Reads a partial written by save(). Returns false if the file isn't one. */
+    bool load(const String &path);
+
+    /** Adds another partial's passes. Returns false, and leaves this one
+      * unchanged, if the two are of different renders or share a pass. */
+    bool add(const PassAccumulator &other);
+
+    /** Passes between 1 and the last one held that no partial rendered */
+    Array<int> missingPasses() const;
+
+    /** The average of the passes held */
+    shared_ptr<Image3> average() const;
+
+    /** The passes held, sorted */
+    const Array<int> &passes() const { return m_passes; }
+
+    int width() const { return m_width; }
+    int height() const { return m_height; }
+
+private:
+    int             m_width;
+    int             m_height;
+    String          m_scene;
+    float           m_gatherRadius;     // radius of pass 1, fixes the schedule
+    float           m_minGatherRadius;  // with the floor
+    uint32          m_renderSeed;
+    uint32          m_scatterSeed;
+    int             m_numBeamettesInDir;
+    bool            m_splatDirect;
+    Array<int>      m_passes;
+    Array<Color3>   m_sum;          // row major
+};
+
+#endif // PASSACCUMULATOR_H
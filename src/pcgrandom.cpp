@@ -0,0 +1,22 @@
+#include "pcgrandom.h"
+
+PCGRandom::PCGRandom(uint64 seed, uint64 stream)
+    // Skips the Mersenne twister setup of the base class
+    : Random((void*)NULL),
+      m_state(0),
+      m_inc((stream << 1) | 1)
+{
+    bits();
+    m_state += seed;
+    bits();
+}
+
+uint32 PCGRandom::bits()
+{
+    uint64 old = m_state;
+    m_state = old * 6364136223846793005ULL + m_inc;
+
+    uint32 xorshifted = uint32(((old >> 18) ^ old) >> 27);
+    uint32 rot = uint32(old >> 59);
+    return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
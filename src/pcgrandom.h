@@ -0,0 +1,37 @@
+#ifndef PCGRANDOM_H
+#define PCGRANDOM_H
+#include <G3D/G3DAll.h>
+
+/** A small, fast random number generator (PCG32, O'Neill 2014) that can be
+  * passed anywhere G3D expects a Random.
+  *
+  * Each (seed, stream) pair is an independent sequence, and the state is
+  * 16 bytes, so one can be made per sample at no cost. Not thread safe:
+  * each thread should own its generators.
+  */
+class PCGRandom
+    : public Random
+{
+public:
+    PCGRandom(uint64 seed, uint64 stream);
+
+    virtual uint32 bits();
+
+    /** Uniform in [0, 1) */
+    virtual float uniform()
+    {
+        return float(bits() >> 8) * (1.f / 16777216.f);
+    }
+
+    /** Uniform in [low, high) */
+    virtual float uniform(float low, float high)
+    {
+        return low + (high - low) * uniform();
+    }
+
+private:
+    uint64  m_state;
+    uint64  m_inc;      // selects the stream, always odd
+};
+
+#endif // PCGRANDOM_H
@@ -1,7 +1,5 @@
 #include "photonbeamette.h"
 
 PhotonBeamette::PhotonBeamette()
-// TODO: make box not axis aligned
-    : G3D::Box()
 {
 }
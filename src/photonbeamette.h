@@ -4,8 +4,10 @@
 #include <iomanip>
 
 
+/** A segment of a photon beam: its endpoints, the major and minor axes of its
+  * elliptical cross-section at each end, and its power.
+  */
 class PhotonBeamette
-        : public G3D::Box
 {
 public:
     PhotonBeamette();
@@ -19,26 +21,6 @@ public:
     int m_splineID = -1; // Associated spline, -1 if an area light
 };
 
-/** Define BoundsTrait for the photon beamettes so we can use them in the KDTree */
-template<> struct BoundsTrait<class PhotonBeamette> {
-    static void getBounds(const PhotonBeamette b, G3D::AABox& out) {
-        G3D::Box box = G3D::Box(b.m_start, b.m_end);
-        box.getBounds(out);
-    }
-};
-/** Define HashTrait for the photon beamettes so we can use them in the KDTree */
-template<> struct HashTrait<class PhotonBeamette> {
-    static size_t hashCode(const PhotonBeamette b) {
-        return b.m_end.x + b.m_end.y*2 + b.m_end.x;
-    }
-};
-/** Define equals so that it works too?*/
-template<> struct EqualsTrait<class PhotonBeamette> {
-    static bool equals(const PhotonBeamette b, const PhotonBeamette b1) {
-            return (b.m_start == b1.m_start) && (b.m_end == b1.m_end);
-    }
-};
-
 inline void printvec(std::ostream & Str, const Vector3& v) {
     Str << std::setprecision(2) << "(" << v.x << ", " << v.y << ", " << v.z << ")";
 }
@@ -1,8 +1,19 @@
 #include "photonscatter.h"
+#include "renderstats.h"
 
 PhotonScatter::PhotonScatter(World * world, shared_ptr<PhotonSettings> settings):
     m_world(world),
     m_PSettings(settings),
+    m_pathIndex(0),
+    m_radius(1)
+{
+}
+
+PhotonScatter::PhotonScatter(World * world, shared_ptr<PhotonSettings> settings, uint32 seed):
+    m_world(world),
+    m_random(seed, false),
+    m_PSettings(settings),
+    m_pathIndex(0),
     m_radius(1)
 {
 }
@@ -11,22 +22,26 @@ PhotonScatter::~PhotonScatter()
 {
 }
 
-void PhotonScatter::shootRay(Array<PhotonBeamette> &beams, int numBeams, int initBounceNum)
+void PhotonScatter::shootRay(BeamStore &beams, int numBeams, int initBounceNum)
 {
     m_beams.clear();
+    m_beamPaths.clear();
+    m_pathIndex = 0;
     // Emit a photon.
     PhotonBeamette beam;
     shared_ptr<Surfel> surfel;
     if (m_world->emitBeam(m_random, beam, surfel, numBeams, m_PSettings->beamSpread))
     {
         // Bounce the beam in the scene and insert the bounced beam into the map.
-        if (beam.m_splineID >= 0){
+        if (m_PSettings->useIterativeScatter){
+            traceBeamPath(beam, initBounceNum);
+        }else if (beam.m_splineID >= 0){
             shootRayRecursiveCurve(beam, initBounceNum, 0); // We're always starting at beginnign of spline
         }else{
             shootRayRecursiveStraight(beam, initBounceNum);
         }
     }
-    beams = m_beams;
+    beams.append(m_beams);
 }
 
 /**
@@ -215,21 +230,20 @@ void PhotonScatter::shootRayRecursiveCurve(PhotonBeamette emittedBeam, int bounc
         return;
     }
 
-    Array<Vector4> spline = m_world->splines()[emittedBeam.m_splineID];
+    const SplineStore &splines = m_world->splineStore();
 
     // if there isn't one more CV, return
-    if (curveStep > spline.length()-2){
+    if (curveStep > splines.numPoints(emittedBeam.m_splineID)-2){
         return;
     }
+    int k = splines.first(emittedBeam.m_splineID) + curveStep;
 
     // A random distance to step forward along the beam.
-    Vector3 startPoint = spline[curveStep].xyz();
-    Vector3 endPoint = spline[curveStep+1].xyz();
-    float startRad = spline[curveStep].w;
-    float endRad = spline[curveStep+1].w;
+    Vector3 endPoint = splines.point(k+1).xyz();
+    float startRad = splines.point(k).w;
+    float endRad = splines.point(k+1).w;
     float marchDist = m_random.uniform() * length(endPoint - emittedBeam.m_start);
-    Vector3 curveDirection =  normalize(endPoint - emittedBeam.m_start);
-    curveDirection = (normalize(endPoint - emittedBeam.m_start) + normalize(spline[curveStep+2].xyz() - endPoint))/2.f;
+    Vector3 curveDirection = (normalize(endPoint - emittedBeam.m_start) + splines.direction(k+1))/2.f;
 
     // Generate random next point based on radius
     float jitter = endRad * m_PSettings->beamSpread;
@@ -251,12 +265,12 @@ void PhotonScatter::shootRayRecursiveCurve(PhotonBeamette emittedBeam, int bounc
     // Store the ray with the point here. Then, scatter forward and out.
     if (!hitSurf && dist < inf())
     {
-        Vector3 nextDirection = spline[curveStep+2].xyz() - beamEndPt;
+        Vector3 nextDirection = splines.point(k+2).xyz() - beamEndPt;
         Vector3 prev = emittedBeam.m_start;
         if (curveStep > 0){
-            prev = spline[curveStep-1].xyz() + -marchDist * curveDirection;
+            prev = splines.point(k-1).xyz() + -marchDist * curveDirection;
         }
-        Vector3 next = spline[curveStep+2].xyz() + marchDist * curveDirection;
+        Vector3 next = splines.point(k+2).xyz() + marchDist * curveDirection;
 
         startRad = max(startRad * m_radius, startRad*.5f);
         endRad = max(endRad * m_radius, endRad* .5f);
@@ -301,6 +315,311 @@ void PhotonScatter::shootRayRecursiveCurve(PhotonBeamette emittedBeam, int bounc
     }
 }
 
+/**
+ * @brief traceBeamPath Iterative equivalent of shootRayRecursiveStraight/Curve. Follows
+ * the beam through the scene one segment at a time, making the same decisions in the same
+ * order (and so drawing the same random numbers) as the recursive tracer.
+ * @param emittedBeam
+ * @param initBounceNum
+ */
+void PhotonScatter::traceBeamPath(const PhotonBeamette &emittedBeam, int initBounceNum)
+{
+    BeamPath path;
+    startBeamPath(emittedBeam, initBounceNum, path);
+
+    BeamSegment segment;
+    while (path.bounces <= m_PSettings->maxDepthScatter && beginSegment(path, segment))
+    {
+        // Shoot the ray into the world and find the surfel it intersects with.
+        float dist = inf();
+        shared_ptr<Surfel> surfel;
+        m_world->intersect(segment.ray, dist, surfel);
+
+        if (!endSegment(path, segment, dist, surfel)) {
+            break;
+        }
+    }
+}
+
+void PhotonScatter::startBeamPath(const PhotonBeamette &emittedBeam, int initBounceNum, BeamPath &path)
+{
+    path.start = emittedBeam.m_start;
+    path.end = emittedBeam.m_end;
+    path.power = emittedBeam.m_power;
+    path.splineID = emittedBeam.m_splineID;
+    path.bounces = initBounceNum;
+    path.curveStep = 0; // We're always starting at beginning of spline
+    path.pathIndex = 0;
+}
+
+void PhotonScatter::shootRaysWavefront(BeamStore &beams, Array<int> &beamPaths, int count, int numBeams, int initBounceNum)
+{
+    Array<BeamPath> paths;
+    int batchSize = max(1, m_PSettings->wavefrontSize);
+
+    for (int first = 0; first < count; first += batchSize)
+    {
+        // Emit a batch of photons.
+        m_beams.clear();
+        m_beamPaths.clear();
+        paths.fastClear();
+        int batchEnd = min(count, first + batchSize);
+        for (int i = first; i < batchEnd; ++i)
+        {
+            PhotonBeamette beam;
+            shared_ptr<Surfel> surfel;
+            if (m_world->emitBeam(m_random, beam, surfel, numBeams, m_PSettings->beamSpread))
+            {
+                BeamPath &path = paths.next();
+                startBeamPath(beam, initBounceNum, path);
+                path.pathIndex = i;
+            }
+        }
+
+        // Bounce the whole batch through the scene.
+        traceWavefront(paths);
+        beams.append(m_beams);
+        beamPaths.append(m_beamPaths);
+    }
+}
+
+/**
+ * @brief traceWavefront Advances all the paths together until every one has terminated.
+ * Each step sets up one segment per path, intersects all the segments with the scene in a
+ * single batch, then resolves them.
+ * @param paths the paths to trace, consumed
+ */
+void PhotonScatter::traceWavefront(Array<BeamPath> &paths)
+{
+    Array<BeamSegment> segments;
+    Array<Ray> rays;
+    Array<float> dists;
+    Array<shared_ptr<Surfel>> surfels;
+
+    while (paths.size() > 0)
+    {
+        // Set up the next segment of every path, dropping the ones that have run out.
+        segments.resize(paths.size(), false);
+        rays.fastClear();
+        int live = 0;
+        for (int i = 0; i < paths.size(); ++i)
+        {
+            if (paths[i].bounces <= m_PSettings->maxDepthScatter && beginSegment(paths[i], segments[live]))
+            {
+                paths[live] = paths[i];
+                rays.append(segments[live].ray);
+                ++live;
+            }
+        }
+        paths.resize(live, false);
+
+        if (live == 0) {
+            break;
+        }
+
+        // Intersect the whole wavefront at once.
+        m_world->intersectBatch(rays, dists, surfels);
+
+        // Resolve the segments, keeping the paths that carry on.
+        int alive = 0;
+        for (int i = 0; i < live; ++i)
+        {
+            m_pathIndex = paths[i].pathIndex;
+            if (endSegment(paths[i], segments[i], dists[i], surfels[i]))
+            {
+                paths[alive] = paths[i];
+                ++alive;
+            }
+        }
+        paths.resize(alive, false);
+    }
+}
+
+/**
+ * @brief beginSegment Draws the march distance (and, on a spline, the jittered end point)
+ * for the next segment of the path and sets up its ray.
+ * @return false if the path has run off the end of its spline
+ */
+bool PhotonScatter::beginSegment(const BeamPath &path, BeamSegment &segment)
+{
+    if (path.splineID < 0)
+    {
+        // A random distance to step forward along the beam.
+        segment.marchDist = m_random.uniform()*getRayMarchDist();
+        segment.ray = Ray(path.start, path.end - path.start);
+        return true;
+    }
+
+    const SplineStore &splines = m_world->splineStore();
+
+    // if there isn't one more CV, stop
+    if (path.curveStep > splines.numPoints(path.splineID)-2){
+        return false;
+    }
+    int k = splines.first(path.splineID) + path.curveStep;
+
+    Vector3 endPoint = splines.point(k+1).xyz();
+    segment.startRad = splines.point(k).w;
+    segment.endRad = splines.point(k+1).w;
+    segment.marchDist = m_random.uniform() * length(endPoint - path.start);
+    segment.curveDirection = (normalize(endPoint - path.start) + splines.direction(k+1))/2.f;
+
+    // Jitter the end point about the curve direction, based on the radius
+    float jitter = segment.endRad * m_PSettings->beamSpread;
+    float randAngle = m_random.uniform()* M_2_PI;
+    Matrix4 rot = CoordinateFrame::fromYAxis(segment.curveDirection).toMatrix4();
+    Vector4 perp = rot * Vector4(cos(randAngle), 0.0, sin(randAngle), 0.0);
+    Vector3 beamEndPt = endPoint + jitter * normalize(perp.xyz());
+    segment.end = path.start + segment.marchDist * normalize(beamEndPt - path.start);
+    segment.ray = Ray(path.start, segment.end - path.start);
+    return true;
+}
+
+/**
+ * @brief endSegment Given where the segment's ray hit the scene, stores the segment and
+ * scatters the path off the surface, into the fog or forward.
+ * @param dist      distance to the hit, inf() if nothing was hit
+ * @param surfel    the surface that was hit, if any
+ * @return false if the path has terminated
+ */
+bool PhotonScatter::endSegment(BeamPath &path, const BeamSegment &segment, float dist, const shared_ptr<Surfel> &surfel)
+{
+    float marchDist = segment.marchDist;
+
+    // The surface is closer than the march distance: store the beam up to the surface,
+    // then scatter off it.
+    if (marchDist > dist)
+    {
+        if (path.bounces > 0)
+        {
+            calculateAndStoreBeam(path.start, surfel->position, path.start, surfel->position, m_radius, m_radius, path.power);
+        }
+
+        // Choose a direction to shoot the beam based on the surfel's BSDF
+        Vector3 wIn = -segment.ray.direction();
+        Vector3 wOut;
+        float probabilityHint = 1.0;
+        Color3 weight = Color3(1.0);
+        surfel->scatter(PathDirection::SOURCE_TO_EYE, wIn, false, m_random, weight, wOut, probabilityHint);
+        Color3 probability = surfel->probabilityOfScattering(PathDirection::SOURCE_TO_EYE, wIn, m_random);
+        weight = weight.clamp(0.0, 1.0);
+
+        // Russian roulette termination
+        float rand = m_random.uniform();
+        float prob = weight.average();
+        if (rand < prob){
+            path.start = Utils::bump(surfel->position, wOut, surfel->shadingNormal);
+            path.end = path.start + wOut;
+            path.power = path.power * weight;
+            path.splineID = -1;
+            path.bounces += 1;
+            return true;
+        }
+        return false;
+    }
+
+    // Nothing to march through
+    if (dist == inf())
+    {
+        return false;
+    }
+
+    // Otherwise we stopped in the fog. Store the beam up to here, then scatter forward or out.
+    if (path.splineID < 0)
+    {
+        Vector3 direction = path.end - path.start;
+        Vector3 beamEndPt = path.start + normalize(direction) * marchDist;
+        if (path.bounces > 0)
+        {
+            calculateAndStoreBeam(path.start, beamEndPt, path.start, beamEndPt, m_radius, m_radius, path.power);
+        }
+
+        float extinctionProb = getExtinctionProbability(marchDist); // 1 - (scat + trans)
+        float remainingProb = 1.f - extinctionProb;
+        float scatterProb = remainingProb * m_PSettings->scattering;
+        float transProb = remainingProb - scatterProb;
+
+        float fogEmission = 1.02f;
+
+        float rng = m_random.uniform();
+
+        if (rng < transProb) {
+            // transmission
+            path.start = beamEndPt;
+            path.end = beamEndPt + direction;
+            path.power = path.power * fogEmission;
+            return true;
+
+        } else if (rng < transProb + scatterProb) {
+            // scattering
+            Vector3 wOut;
+            phaseFxn(direction, wOut);
+            path.start = beamEndPt;
+            path.end = beamEndPt + wOut;
+            path.power = path.power * fogEmission;
+            return true;
+        }
+        // otherwise, extinction
+        return false;
+    }
+
+    const SplineStore &splines = m_world->splineStore();
+    int curveStep = path.curveStep;
+    int k = splines.first(path.splineID) + curveStep;
+    Vector3 beamEndPt = segment.end;
+
+    Vector3 nextDirection = splines.point(k+2).xyz() - beamEndPt;
+    Vector3 prev = path.start;
+    if (curveStep > 0){
+        prev = splines.point(k-1).xyz() + -marchDist * segment.curveDirection;
+    }
+    Vector3 next = splines.point(k+2).xyz() + marchDist * segment.curveDirection;
+
+    float startRad = max(segment.startRad * m_radius, segment.startRad*.5f);
+    float endRad = max(segment.endRad * m_radius, segment.endRad* .5f);
+
+    if (path.bounces > 0) {
+        calculateAndStoreBeam(path.start, beamEndPt, prev, next, startRad, endRad, path.power);
+    }
+
+    // mandate that at least some light from beam is scattered.
+    float adjustedScattering = m_PSettings->scattering;
+    if (adjustedScattering == 0.f) {
+        adjustedScattering = .01f;
+    }
+
+    float extinctionProb = getExtinctionProbability(marchDist); // 1 - (scat + trans)
+    float remainingProb = 1.f - extinctionProb;
+    float scatterProb = remainingProb * adjustedScattering;
+    float transProb = remainingProb - scatterProb;
+
+    float rng = m_random.uniform();
+
+    // use intensity setting to determine how scattering power of curved beams is scaled;
+    float powerReduction = max((m_PSettings->beamIntensity / 20.f) + 1.f, 1.1f);
+
+    if (rng < transProb || (rng < transProb + scatterProb && curveStep == 0)) {
+        // transmission (the first segment always stays on the spline)
+        path.start = beamEndPt;
+        path.end = beamEndPt + nextDirection;
+        path.power = path.power * powerReduction;
+        path.curveStep += 1;
+        return true;
+
+    } else if (rng < transProb + scatterProb) {
+        // scattering, leaves the spline
+        Vector3 wOut;
+        phaseFxn(nextDirection, wOut);
+        path.start = beamEndPt;
+        path.end = beamEndPt + wOut;
+        path.power = path.power * powerReduction;
+        path.splineID = -1;
+        return true;
+    }
+    // otherwise, extinction
+    return false;
+}
+
 /**
  * @brief calculateAndStoreBeam calculates the power, direction, etc of the beam, and stores it in the array.
  * @param startPt   start point
@@ -314,6 +633,7 @@ void PhotonScatter::shootRayRecursiveCurve(PhotonBeamette emittedBeam, int bounc
 void PhotonScatter::calculateAndStoreBeam(Vector3 startPt, Vector3 endPt, Vector3 prev,
                                           Vector3 next, float startRad, float endRad, Color3 power)
 {
+    STATS_COUNT(BEAMS_STORED, 1);
     PhotonBeamette beam = PhotonBeamette();
     beam.m_start =  startPt;
     beam.m_end = endPt;
@@ -354,7 +674,8 @@ void PhotonScatter::calculateAndStoreBeam(Vector3 startPt, Vector3 endPt, Vector
         beam.m_end_major = endr * majdir;
         beam.m_end_minor = endRad * normalize(cross(vbeam, beam_next));
     }
-    m_beams.push_back(beam);
+    m_beams.append(beam);
+    m_beamPaths.append(m_pathIndex);
 }
 
 void PhotonScatter::setRadius(float radius)
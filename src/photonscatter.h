@@ -3,6 +3,7 @@
 #include <G3D/G3DAll.h>
 
 #include "photonbeamette.h"
+#include "beamstore.h"
 #include "world.h"
 #include "photonsettings.h"
 
@@ -10,6 +11,9 @@ class PhotonScatter
 {
 public:
     PhotonScatter(World * world, shared_ptr<PhotonSettings> settings);
+
+    /** Creates a scatterer with its own, unlocked random stream. Used for per-thread workers. */
+    PhotonScatter(World * world, shared_ptr<PhotonSettings> settings, uint32 seed);
     ~PhotonScatter();
     void setRadius(float radius);
 
@@ -32,13 +36,24 @@ protected:
     /**
      * Actually shoots a single ray into the scene, accumulates an array of photons
      * to be added to the KD tree or array.
-     * Returns an array of PhotonBeams
-     * @param beams the array that will be populated with the beams in the scene
+     * @param beams the store the beams in the scene are appended to
      * @param numBeams the total number of beams to be initially shot out
      * @param initBounceNum the initial bounce number (we want to store the first bounce for direct photon beams, but not for indirect)
      * TODO:: initBounceNum is a stupid hack. Fix it.
      */
-    void shootRay(Array<PhotonBeamette> &beams, int numBeams, int initBounceNum);
+    void shootRay(BeamStore &beams, int numBeams, int initBounceNum);
+
+    /**
+     * Wavefront version of shootRay: emits count beams and advances them through the scene
+     * together, wavefrontSize paths at a time, one segment per step. The decisions are the same
+     * as traceBeamPath's, but the random numbers are drawn in a different order.
+     * @param beams the store the beams in the scene are appended to
+     * @param beamPaths appended to with, for each beam, which of the count emitted beams it came from
+     * @param count the number of beams to shoot
+     * @param numBeams the total number of beams to be initially shot out (for weighting)
+     * @param initBounceNum the initial bounce number
+     */
+    void shootRaysWavefront(BeamStore &beams, Array<int> &beamPaths, int count, int numBeams, int initBounceNum);
 
     /**
      * @brief calculateAndStoreBeam calculates the power, direction, etc of the beam, and stores it in the array.
@@ -113,10 +128,73 @@ protected:
 
     float getExtinctionProbability(float marchDist);
 
+    /** The state of a beam path between two scattering events. This is all the
+     *  iterative tracer carries from one segment to the next.
+     */
+    struct BeamPath
+    {
+        Point3  start;      // start of the next segment
+        Point3  end;        // a point along the next segment, unused on a spline
+        Power3  power;
+        int     splineID;   // spline being followed, -1 for a straight path
+        int     bounces;    // surface bounces so far
+        int     curveStep;  // control point the segment starts from, spline paths only
+        int     pathIndex;  // which emitted beam the path came from
+    };
+
+    /** A segment of a beam path that has been set up but not yet intersected with the scene */
+    struct BeamSegment
+    {
+        Ray     ray;            // ray to intersect the scene with
+        float   marchDist;      // distance marched into the fog
+        Point3  end;            // end of the segment if it stops in the fog, spline paths only
+        Vector3 curveDirection; // averaged spline tangent, spline paths only
+        float   startRad;       // control point radii, spline paths only
+        float   endRad;
+    };
+
+    /**
+     * @brief traceBeamPath Iterative equivalent of shootRayRecursiveStraight/Curve. Follows
+     * the beam through the scene one segment at a time, making the same decisions in the same
+     * order (and so drawing the same random numbers) as the recursive tracer.
+     * @param emittedBeam
+     * @param initBounceNum
+     */
+    void traceBeamPath(const PhotonBeamette &emittedBeam, int initBounceNum);
+
+    /** Sets up the path state of a freshly emitted beam */
+    void startBeamPath(const PhotonBeamette &emittedBeam, int initBounceNum, BeamPath &path);
+
+    /**
+     * @brief traceWavefront Advances all the paths together until every one has terminated.
+     * Each step sets up one segment per path, intersects all the segments with the scene in a
+     * single batch, then resolves them.
+     * @param paths the paths to trace, consumed
+     */
+    void traceWavefront(Array<BeamPath> &paths);
+
+    /**
+     * @brief beginSegment Draws the march distance (and, on a spline, the jittered end point)
+     * for the next segment of the path and sets up its ray.
+     * @return false if the path has run off the end of its spline
+     */
+    bool beginSegment(const BeamPath &path, BeamSegment &segment);
+
+    /**
+     * @brief endSegment Given where the segment's ray hit the scene, stores the segment and
+     * scatters the path off the surface, into the fog or forward.
+     * @param dist      distance to the hit, inf() if nothing was hit
+     * @param surfel    the surface that was hit, if any
+     * @return false if the path has terminated
+     */
+    bool endSegment(BeamPath &path, const BeamSegment &segment, float dist, const shared_ptr<Surfel> &surfel);
+
     World* m_world;
     Random m_random;   // Random number generator
     shared_ptr<PhotonSettings> m_PSettings;
-    Array<PhotonBeamette> m_beams;
+    BeamStore m_beams;       // beams stored by the path(s) being traced
+    Array<int> m_beamPaths;  // for each of m_beams, the path that stored it
+    int m_pathIndex;         // path being traced, tags the stored beams
     float m_radius;
 };
 
@@ -0,0 +1,169 @@
+#include "photonsettings.h"
+#include "threadpool.h"
+
+PhotonSettings::PhotonSettings()
+{
+    superSamples=1;
+    attenuation=0.0; // variable in transmission calculation
+    scattering=0.0; // ratio of scattering to extinction
+
+    noiseBiasRatio=0.0;
+    radiusScalingFactor=0.95;
+    useMedium=false;
+    renderSplines=false;
+    lightEnabled=true;
+
+    maxDepthScatter=100;
+    useIterativeScatter=true;
+    useWavefrontScatter=false;
+    wavefrontSize=4096;
+    maxDepthRender=3;
+    epsilon=0.0001;
+    numBeamettesDir=10;
+    numBeamettesInDir=2000;
+    numScatterThreads=Thread::numCores();
+    // One render thread per CPU this process may use
+    int allowedCpus = ThreadPool::allowedCpus().size();
+    numRenderThreads=(allowedCpus > 0) ? allowedCpus : Thread::numCores();
+    scatterSeed=0xF018A4D2;
+    beamRefreshFraction=1.0;
+    checkpointInterval=10;
+
+    directSamples=64;
+
+    gatherRadius=0.5;
+    minGatherRadius=0.0;
+    useFinalGather=false;
+    useBeamGrid=false;
+    renderSeed=0x2545F491;
+    gatherSamples=50;
+    dist = .5;
+    cullBeams = true;
+    splatDirect = false;
+    beamIntensity = 1;
+    beamSpread = 1;
+}
+
+static bool read(const Any &value, float &out)
+{
+    if (value.type() != Any::NUMBER) return false;
+    out = float(value.number());
+    return true;
+}
+
+static bool read(const Any &value, int &out)
+{
+    if (value.type() != Any::NUMBER) return false;
+    out = iRound(value.number());
+    return true;
+}
+
+static bool read(const Any &value, unsigned int &out)
+{
+    if (value.type() != Any::NUMBER || value.number() < 0) return false;
+    out = (unsigned int)value.number();
+    return true;
+}
+
+static bool read(const Any &value, bool &out)
+{
+    if (value.type() != Any::BOOLEAN) return false;
+    out = value.boolean();
+    return true;
+}
+
+static bool read(const Any &value, Array<int> &out)
+{
+    if (value.type() != Any::ARRAY) return false;
+    Array<int> cpus;
+    for (int i = 0; i < value.size(); ++i)
+    {
+        int cpu;
+        if (!read(value[i], cpu)) return false;
+        cpus.append(cpu);
+    }
+    out = cpus;
+    return true;
+}
+
+bool PhotonSettings::set(const String &name, const Any &value)
+{
+#define SETTING(field) if (name == #field) return read(value, field)
+    SETTING(superSamples);
+    SETTING(attenuation);
+    SETTING(scattering);
+    SETTING(radiusScalingFactor);
+    SETTING(noiseBiasRatio);
+    SETTING(useMedium);
+    SETTING(renderSplines);
+    SETTING(lightEnabled);
+    SETTING(maxDepthScatter);
+    SETTING(useIterativeScatter);
+    SETTING(useWavefrontScatter);
+    SETTING(wavefrontSize);
+    SETTING(maxDepthRender);
+    SETTING(epsilon);
+    SETTING(numBeamettesDir);
+    SETTING(numBeamettesInDir);
+    SETTING(numRenderThreads);
+    SETTING(renderAffinity);
+    SETTING(numScatterThreads);
+    SETTING(scatterSeed);
+    SETTING(beamRefreshFraction);
+    SETTING(checkpointInterval);
+    SETTING(renderSeed);
+    SETTING(directSamples);
+    SETTING(gatherSamples);
+    SETTING(useBeamGrid);
+    SETTING(gatherRadius);
+    SETTING(minGatherRadius);
+    SETTING(useFinalGather);
+    SETTING(dist);
+    SETTING(cullBeams);
+    SETTING(splatDirect);
+    SETTING(beamIntensity);
+    SETTING(beamSpread);
+#undef SETTING
+    return false;
+}
+
+bool PhotonSettings::set(const Any &table)
+{
+    if (table.type() != Any::TABLE) return false;
+
+    bool ok = true;
+    const Table<String, Any> &entries = table.table();
+    for (Table<String, Any>::Iterator it = entries.begin(); it.isValid(); ++it)
+    {
+        if (!set(it->key, it->value)) {
+            printf("Bad setting %s\n", it->key.c_str());
+            ok = false;
+        }
+    }
+    return ok;
+}
+
+float PhotonSettings::gatherRadiusForPass(int pass) const
+{
+    // the closer this value is to 1, the slower the radius will decrease.
+    float radReductionRate = 1.08f;
+
+    return max(gatherRadius / pow(radReductionRate, (pass - 1)), minGatherRadius);
+}
+
+uint32 PhotonSettings::scatterSeedForPass(int pass) const
+{
+    return scatterSeed ^ (uint32(pass - 1) * 0x85EBCA6Bu);
+}
+
+const float PhotonSettings::MIN_BEAM_RADIUS = 0.05f;
+
+float PhotonSettings::beamRadiusForPass(int pass) const
+{
+    return max(pow(radiusScalingFactor, float(pass - 1)), MIN_BEAM_RADIUS);
+}
+
+float PhotonSettings::splatPowerScale(int numBeams) const
+{
+    return (numBeams > 0) ? square(beamIntensity) / numBeams : 0.f;
+}
@@ -1,8 +1,42 @@
 #ifndef PHOTONSETTINGS_H
 #define PHOTONSETTINGS_H
+#include <G3D/G3DAll.h>
+
 class PhotonSettings
 {
 public:
+    /** Fills in the default settings */
+    PhotonSettings();
+
+    /** Sets the setting with the given field name, e.g. "gatherRadius".
+      * Returns false if there is no such setting or the value has the wrong type. */
+    bool set(const String &name, const Any &value);
+
+    /** Sets every setting in a table, e.g. PhotonSettings { gatherRadius = 0.2; }.
+      * Returns false if any entry couldn't be set. */
+    bool set(const Any &table);
+
+    /** Gather radius of a (1-based) pass: gatherRadius, shrinking with every
+      * pass down to minGatherRadius */
+    float gatherRadiusForPass(int pass) const;
+
+    /** Scatter seed of a render that starts at a (1-based) pass: scatterSeed
+      * for pass 1, mixed with the pass otherwise, so that renders starting
+      * at different passes scatter different beams. */
+    uint32 scatterSeedForPass(int pass) const;
+
+    /** Radius of the direct beams of a (1-based) pass: 1, shrinking by
+      * radiusScalingFactor with every pass down to MIN_BEAM_RADIUS, as
+      * the app's shrinks with every batch it splats */
+    float beamRadiusForPass(int pass) const;
+
+    /** Scale of the power of each of numBeams direct beams splatted in a pass */
+    float splatPowerScale(int numBeams) const;
+
+    static const float MIN_BEAM_RADIUS;
+
+    // Passes between checkpoints of a render with a checkpoint file (0: only when it stops).
+    int checkpointInterval;
 
     int superSamples; // for say, stratified sampling
     float attenuation; // refracted path absorption through non-vacuum spaces
@@ -16,6 +50,12 @@ public:
 
     // Recursion depth for photon scattering.
     int maxDepthScatter;
+    // Trace beam paths with the iterative tracer instead of the recursive one.
+    bool useIterativeScatter;
+    // Advance batches of beam paths one segment at a time, intersecting each batch together.
+    bool useWavefrontScatter;
+    // Number of beam paths in flight per wavefront batch.
+    int wavefrontSize;
     // Recursion depth for rendering.
     int maxDepthRender;
     // Used for bumping.
@@ -23,18 +63,38 @@ public:
     // Number of beamettes to shoot into the scene.
     int numBeamettesDir;
     int numBeamettesInDir;
+    // Number of threads in the render pool.
+    int numRenderThreads;
+    // CPUs the render threads are pinned to, in order (empty: not pinned).
+    Array<int> renderAffinity;
+    // Number of worker threads that scatter and index the indirect beams.
+    int numScatterThreads;
+    // Seed for the indirect scattering random streams (one stream per worker).
+    unsigned int scatterSeed;
+    // Fraction of the indirect beam paths re-shot each pass (1 rebuilds the whole map).
+    float beamRefreshFraction;
+    // Seed for the per-pixel render random streams (mixed with the pixel and pass).
+    unsigned int renderSeed;
     // Number of samples to take of direct light sources.
     int directSamples;
     // number of ray samples for final gather.
     int gatherSamples;
+    // Gather from a hashed grid sized to the gather radius instead of the beam hierarchy.
+    bool useBeamGrid;
     // Max distance between intersection point and photons in map.
     //TODO: is this the same as radius scaling factor?
     float gatherRadius;
+    // Floor of the shrinking gather radius (0: it shrinks forever).
+    float minGatherRadius;
     // Whether or not to use final gather
     bool useFinalGather;
     // Expected raymarch step along the ray when scattering.
     // TODO: should this just be taken care of in the fog stuff?
     float dist;
+    // Drop the direct beams that are off screen or hidden before they are uploaded.
+    bool cullBeams;
+    // Batch renders: splat the direct beams on the CPU and add them to every pass.
+    bool splatDirect;
     // The rendered intensity scale
     float beamIntensity;
     // Spread of the beam (angle that light can scatter from the emittor)
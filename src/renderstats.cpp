@@ -0,0 +1,144 @@
+#include "renderstats.h"
+
+#ifdef ILLUMINATI_STATS
+
+#include <atomic>
+#include <mutex>
+
+static const char *COUNTER_NAMES[RenderStats::NUM_COUNTERS] = {
+    "raysIntersect", "raysLineOfSight", "beamsStored", "gathers",
+    "gatherNodesVisited", "gatherBeamsTested", "gatherBeamsReturned", "splineLightsSkipped"
+};
+
+static const char *STAGE_NAMES[RenderStats::NUM_STAGES] = {
+    "scatter", "index", "gather", "scatterWait", "splat"
+};
+
+/** The counters of one thread. Only the owner writes them, so the atomics
+  * are only there to let endPass() read them while the thread runs; the
+  * relaxed load and store compile to plain moves. */
+struct CounterBlock
+{
+    std::atomic<int64> counts[RenderStats::NUM_COUNTERS];
+
+    CounterBlock() {
+        for (int c = 0; c < RenderStats::NUM_COUNTERS; ++c)
+            counts[c] = 0;
+    }
+};
+
+/** Every thread's block, and the totals of the threads that have exited.
+  * Threads come and go with the pools and scatterers of each render, so
+  * their counts are folded into retired when they exit rather than kept
+  * around. */
+struct Registry
+{
+    std::mutex              mutex;
+    Array<CounterBlock*>    blocks;
+    int64                   retired[RenderStats::NUM_COUNTERS];
+    int64                   reported[RenderStats::NUM_COUNTERS];
+    double                  stageTimes[RenderStats::NUM_STAGES];
+    FILE *                  file;
+
+    Registry() : file(NULL) {
+        for (int c = 0; c < RenderStats::NUM_COUNTERS; ++c)
+            retired[c] = reported[c] = 0;
+        for (int s = 0; s < RenderStats::NUM_STAGES; ++s)
+            stageTimes[s] = 0.0;
+    }
+};
+
+/** Never destroyed, so threads can still retire during exit */
+static Registry &registry()
+{
+    static Registry *r = new Registry();
+    return *r;
+}
+
+/** Registers the block of a thread on its first count and retires it when the thread exits */
+struct ThreadCounters
+{
+    CounterBlock *block;
+
+    ThreadCounters() : block(new CounterBlock()) {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.blocks.append(block);
+    }
+
+    ~ThreadCounters() {
+        Registry &r = registry();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        for (int c = 0; c < RenderStats::NUM_COUNTERS; ++c)
+            r.retired[c] += block->counts[c].load(std::memory_order_relaxed);
+        r.blocks.fastRemove(r.blocks.findIndex(block));
+        delete block;
+    }
+};
+
+void RenderStats::count(Counter c, int64 n)
+{
+    static thread_local ThreadCounters t_counters;
+    std::atomic<int64> &counter = t_counters.block->counts[c];
+    counter.store(counter.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+void RenderStats::stageTime(Stage s, double seconds)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    r.stageTimes[s] += seconds;
+}
+
+/** Sum of a counter over the threads, with r.mutex held */
+static int64 sum(Registry &r, RenderStats::Counter c)
+{
+    int64 total = r.retired[c];
+    for (int b = 0; b < r.blocks.size(); ++b)
+        total += r.blocks[b]->counts[c].load(std::memory_order_relaxed);
+    return total;
+}
+
+int64 RenderStats::total(Counter c)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    return sum(r, c);
+}
+
+void RenderStats::endPass(int pass)
+{
+    Registry &r = registry();
+    std::lock_guard<std::mutex> lock(r.mutex);
+
+    if (!r.file)
+    {
+        const char *path = getenv("ILLUMINATI_STATS_FILE");
+        if (!path)
+            path = "illuminati-stats.jsonl";
+        r.file = fopen(path, "a");
+        if (!r.file) {
+            printf("Could not write %s, stats are off\n", path);
+            return;
+        }
+    }
+
+    fprintf(r.file, "{ \"pass\": %d", pass);
+    for (int c = 0; c < NUM_COUNTERS; ++c)
+    {
+        int64 total = sum(r, Counter(c));
+        fprintf(r.file, ", \"%s\": %lld", COUNTER_NAMES[c], (long long)(total - r.reported[c]));
+        r.reported[c] = total;
+    }
+
+    fprintf(r.file, ", \"stageMs\": { ");
+    for (int s = 0; s < NUM_STAGES; ++s)
+    {
+        fprintf(r.file, "%s\"%s\": %.3f", (s > 0) ? ", " : "", STAGE_NAMES[s], r.stageTimes[s] * 1000.0);
+        r.stageTimes[s] = 0.0;
+    }
+    fprintf(r.file, " } }\n");
+    fflush(r.file);
+}
+
+#endif // ILLUMINATI_STATS
@@ -0,0 +1,78 @@
+#ifndef RENDERSTATS_H
+#define RENDERSTATS_H
+
+/** Per-pass counters and stage timers for the hot paths of the renderer.
+  *
+  * Built only when ILLUMINATI_STATS is defined (qmake CONFIG+=stats).
+  * Otherwise the STATS_* macros expand to a sizeof of their argument, which
+  * is never evaluated, so the counting points cost nothing. Code that only
+  * gathers numbers for them, like the gathers' BeamQueryStats, is left out
+  * with #ifdef ILLUMINATI_STATS.
+  *
+  * Each thread counts into its own block, so counting is a plain add with
+  * no atomics or locks. At the end of a pass, RenderStats::endPass() sums
+  * the blocks, subtracts the totals of the previous pass and appends the
+  * difference to a file as one line of JSON:
+  *
+  *   { "pass": 3, "raysIntersect": ..., ..., "stageMs": { "scatter": ..., ... } }
+  *
+  * The file is illuminati-stats.jsonl in the working directory, or
+  * $ILLUMINATI_STATS_FILE.
+  */
+
+#ifdef ILLUMINATI_STATS
+
+#include <G3D/G3DAll.h>
+
+#define STATS_COUNT(counter, n)     RenderStats::count(RenderStats::counter, (n))
+#define STATS_STAGE(stage, seconds) RenderStats::stageTime(RenderStats::stage, (seconds))
+#define STATS_END_PASS(pass)        RenderStats::endPass(pass)
+
+class RenderStats
+{
+public:
+    enum Counter {
+        RAYS_INTERSECT,         // World::intersect and intersectBatch rays
+        RAYS_LINE_OF_SIGHT,     // World::lineOfSight rays
+        BEAMS_STORED,           // PhotonScatter::calculateAndStoreBeam calls
+        GATHERS,                // IndRenderer::diffuse beam queries
+        GATHER_NODES_VISITED,   // index nodes (or grid cells) visited by the queries
+        GATHER_BEAMS_TESTED,    // beams the queries ran the distance test on
+        GATHER_BEAMS_RETURNED,  // beams the queries returned
+        SPLINE_LIGHTS_SKIPPED,  // IndRenderer::direct samples that fell on a spline light
+        NUM_COUNTERS
+    };
+
+    enum Stage {
+        STAGE_SCATTER,          // scattering beams, in the foreground or background
+        STAGE_INDEX,            // sizing the gather radius and building its index
+        STAGE_GATHER,           // the render pool tracing the image
+        STAGE_SCATTER_WAIT,     // gather finished, waiting on the background scatter
+        STAGE_SPLAT,            // splatting the direct beams on the CPU
+        NUM_STAGES
+    };
+
+    /** Adds n to a counter of the calling thread */
+    static void count(Counter c, int64 n);
+
+    /** Adds to the wall time of a stage in the current pass */
+    static void stageTime(Stage s, double seconds);
+
+    /** What all the threads have counted so far, over the life of the process */
+    static int64 total(Counter c);
+
+    /** Writes what was counted since the last call as the line of a pass */
+    static void endPass(int pass);
+};
+
+#else
+
+// sizeof keeps the arguments unevaluated but still used, so the timers that
+// only feed STATS_STAGE do not warn
+#define STATS_COUNT(counter, n)     ((void)sizeof(n))
+#define STATS_STAGE(stage, seconds) ((void)sizeof(seconds))
+#define STATS_END_PASS(pass)        ((void)sizeof(pass))
+
+#endif // ILLUMINATI_STATS
+
+#endif // RENDERSTATS_H
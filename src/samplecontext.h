@@ -0,0 +1,25 @@
+#ifndef SAMPLECONTEXT_H
+#define SAMPLECONTEXT_H
+#include <G3D/G3DAll.h>
+
+#include "pcgrandom.h"
+
+/** State of one pixel sample, passed down IndRenderer::trace.
+  *
+  * Each sample owns its random stream, picked by pixel and seeded by pass,
+  * so render threads share nothing and a pass renders the same image
+  * whichever thread draws each pixel.
+  */
+class SampleContext
+{
+public:
+    SampleContext(int x, int y, int pass, uint32 seed)
+        : random((uint64(uint32(pass)) << 32) | seed,
+                 (uint64(uint32(y)) << 32) | uint32(x))
+    {
+    }
+
+    PCGRandom random;
+};
+
+#endif // SAMPLECONTEXT_H
@@ -0,0 +1,543 @@
+#include "scenecache.h"
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// "ILSC". A file of the other byte order doesn't match it.
+static const uint32 MAGIC = 0x43534C49;
+
+static const uint64 FNV_OFFSET = 0xcbf29ce484222325ULL;
+static const uint64 FNV_PRIME = 0x100000001b3ULL;
+
+static uint64 fnv(uint64 hash, const void *data, size_t size)
+{
+    const uint8 *bytes = static_cast<const uint8 *>(data);
+    for (size_t i = 0; i < size; ++i)
+    {
+        hash = (hash ^ bytes[i]) * FNV_PRIME;
+    }
+    return hash;
+}
+
+static void copy(float *out, const Vector3 &v)
+{
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+}
+
+static void copy(float *out, const Vector4 &v)
+{
+    out[0] = v.x;
+    out[1] = v.y;
+    out[2] = v.z;
+    out[3] = v.w;
+}
+
+static void copy(float *out, const Color3 &c)
+{
+    out[0] = c.r;
+    out[1] = c.g;
+    out[2] = c.b;
+}
+
+static void copy(float *out, const Color4 &c)
+{
+    out[0] = c.r;
+    out[1] = c.g;
+    out[2] = c.b;
+    out[3] = c.a;
+}
+
+/** Whether a material component is the same everywhere */
+template <class Component>
+static bool constant(const Component &c)
+{
+    return c.min() == c.max();
+}
+
+SceneCache::SceneCache()
+    : m_materialData(NULL),
+      m_runData(NULL),
+      m_vertexData(NULL),
+      m_indexData(NULL),
+      m_splineLengthData(NULL),
+      m_splinePointData(NULL),
+      m_map(NULL),
+      m_mapSize(0)
+{
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+SceneCache::~SceneCache()
+{
+    unmap();
+}
+
+uint64 SceneCache::key(const Array<String> &files)
+{
+    uint32 version = VERSION;
+    uint64 hash = fnv(FNV_OFFSET, &version, sizeof(version));
+    for (int i = 0; i < files.size(); ++i)
+    {
+        std::ifstream in(files[i].c_str(), std::ios::binary);
+        if (!in) {
+            hash = fnv(hash, files[i].c_str(), files[i].size());
+            continue;
+        }
+
+        char buffer[1 << 16];
+        while (in.read(buffer, sizeof(buffer)) || in.gcount() > 0)
+        {
+            hash = fnv(hash, buffer, size_t(in.gcount()));
+        }
+    }
+    return hash;
+}
+
+String SceneCache::filename(const String &directory, const String &path)
+{
+    // Scenes of the same name in different directories get their own file
+    size_t slash = path.find_last_of("/\\");
+    String name = slash == String::npos ? path : path.substr(slash + 1);
+    name = name.substr(0, name.find('.'));
+    uint64 hash = fnv(FNV_OFFSET, path.c_str(), path.size());
+    return format("%s/%s-%016llx.scache", directory.c_str(), name.c_str(), (unsigned long long)hash);
+}
+
+int SceneCache::addMaterial(const shared_ptr<Material> &material, Table<shared_ptr<Material>, int> &materials)
+{
+    const int *index = materials.getPointer(material);
+    if (index) {
+        return *index;
+    }
+
+    shared_ptr<UniversalMaterial> mtl = dynamic_pointer_cast<UniversalMaterial>(material);
+    if (!mtl || mtl->bump()) {
+        return -1;
+    }
+    const shared_ptr<UniversalBSDF> &bsdf = mtl->bsdf();
+    if (!constant(bsdf->lambertian()) || !constant(bsdf->glossy()) ||
+        !constant(bsdf->transmissive()) || !constant(mtl->emissive())) {
+        return -1;
+    }
+
+    MaterialRecord &record = m_materials.next();
+    copy(record.lambertian, bsdf->lambertian().mean());
+    copy(record.glossy, bsdf->glossy().mean());
+    copy(record.transmissive, bsdf->transmissive().mean());
+    copy(record.emissive, mtl->emissive().mean());
+    record.etaTransmit = bsdf->etaTransmit();
+    record.etaReflect = bsdf->etaReflect();
+
+    materials.set(material, m_materials.size() - 1);
+    return m_materials.size() - 1;
+}
+
+bool SceneCache::addRuns(const Array<Tri> &tris, const Array<int> *splineIds, const CPUVertexArray &verts,
+                         uint32 flags, Table<shared_ptr<Material>, int> &materials)
+{
+    RunRecord *run = NULL;
+    Table<int, int> remap;  // vertex in verts -> vertex of the run
+
+    for (int t = 0; t < tris.size(); ++t)
+    {
+        const Tri &tri = tris[t];
+        int material = addMaterial(tri.material(), materials);
+        if (material < 0) {
+            return false;
+        }
+        int splineId = splineIds ? (*splineIds)[t] : -1;
+        uint32 triFlags = flags | (tri.twoSided() ? TWO_SIDED : 0);
+
+        if (!run || run->material != uint32(material) || run->splineId != splineId || run->flags != triFlags)
+        {
+            run = &m_runs.next();
+            run->firstVertex = m_vertices.size();
+            run->numVertices = 0;
+            run->firstIndex = m_indices.size();
+            run->numIndices = 0;
+            run->material = material;
+            run->splineId = splineId;
+            run->flags = triFlags;
+            remap.clear();
+        }
+
+        for (int i = 0; i < 3; ++i)
+        {
+            const CPUVertexArray::Vertex &v = tri.vertex(verts, i);
+            int index = int(&v - verts.vertex.getCArray());
+
+            bool created = false;
+            int &local = remap.getCreate(index, created);
+            if (created) {
+                local = run->numVertices++;
+                VertexRecord &record = m_vertices.next();
+                copy(record.position, v.position);
+                copy(record.normal, v.normal);
+                copy(record.tangent, v.tangent);
+                record.texCoord[0] = v.texCoord0.x;
+                record.texCoord[1] = v.texCoord0.y;
+            }
+            m_indices.append(local);
+            ++run->numIndices;
+        }
+    }
+    return true;
+}
+
+bool SceneCache::build(const Array<Tri> &tris, const Array<int> &splineIds, const CPUVertexArray &verts,
+                       const Array<Tri> &previewTris, const CPUVertexArray &previewVerts,
+                       const Array<Array<Vector4>> &splines)
+{
+    unmap();
+    m_materials.fastClear();
+    m_runs.fastClear();
+    m_vertices.fastClear();
+    m_indices.fastClear();
+    m_splineLengths.fastClear();
+    m_splinePoints.fastClear();
+
+    Table<shared_ptr<Material>, int> materials;
+    if (!addRuns(tris, &splineIds, verts, 0, materials) ||
+        !addRuns(previewTris, NULL, previewVerts, PREVIEW, materials)) {
+        return false;
+    }
+
+    for (int i = 0; i < splines.size(); ++i)
+    {
+        m_splineLengths.append(splines[i].size());
+        m_splinePoints.append(splines[i]);
+    }
+
+    pointAtArrays();
+    return true;
+}
+
+void SceneCache::pointAtArrays()
+{
+    m_header.magic = MAGIC;
+    m_header.version = VERSION;
+    m_header.numMaterials = m_materials.size();
+    m_header.numRuns = m_runs.size();
+    m_header.numVertices = m_vertices.size();
+    m_header.numIndices = m_indices.size();
+    m_header.numSplines = m_splineLengths.size();
+    m_header.numSplinePoints = m_splinePoints.size();
+
+    m_materialData = m_materials.getCArray();
+    m_runData = m_runs.getCArray();
+    m_vertexData = m_vertices.getCArray();
+    m_indexData = m_indices.getCArray();
+    m_splineLengthData = m_splineLengths.getCArray();
+    m_splinePointData = reinterpret_cast<const float *>(m_splinePoints.getCArray());
+}
+
+bool SceneCache::save(const String &path, uint64 key) const
+{
+    if (m_header.magic != MAGIC) {
+        return false;
+    }
+
+    Header header = m_header;
+    header.key = key;
+
+    String temp = path + ".tmp";
+    {
+        BinaryOutput out(temp, G3D_LITTLE_ENDIAN);
+        out.writeBytes(&header, sizeof(header));
+        out.writeBytes(m_materialData, int64(header.numMaterials) * sizeof(MaterialRecord));
+        out.writeBytes(m_runData, int64(header.numRuns) * sizeof(RunRecord));
+        out.writeBytes(m_vertexData, int64(header.numVertices) * sizeof(VertexRecord));
+        out.writeBytes(m_indexData, int64(header.numIndices) * sizeof(uint32));
+        out.writeBytes(m_splineLengthData, int64(header.numSplines) * sizeof(uint32));
+        out.writeBytes(m_splinePointData, int64(header.numSplinePoints) * 4 * sizeof(float));
+        out.commit();
+        if (!out.ok()) {
+            return false;
+        }
+    }
+    return ::rename(temp.c_str(), path.c_str()) == 0;
+}
+
+bool SceneCache::load(const String &path, uint64 key)
+{
+    unmap();
+#ifdef __linux__
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (::fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(Header)) {
+        ::close(fd);
+        return false;
+    }
+    void *map = ::mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (map == MAP_FAILED) {
+        return false;
+    }
+    m_map = map;
+    m_mapSize = st.st_size;
+
+    if (!point(key)) {
+        printf("%s is stale, reloading the scene\n", path.c_str());
+        unmap();
+        return false;
+    }
+    return true;
+#else
+    // Without mmap the scene is parsed every time
+    (void)path;
+    (void)key;
+    return false;
+#endif
+}
+
+bool SceneCache::point(uint64 key)
+{
+    const uint8 *data = static_cast<const uint8 *>(m_map);
+    memcpy(&m_header, data, sizeof(Header));
+    if (m_header.magic != MAGIC || m_header.version != VERSION || m_header.key != key) {
+        return false;
+    }
+
+    uint64 size = sizeof(Header) +
+                  uint64(m_header.numMaterials) * sizeof(MaterialRecord) +
+                  uint64(m_header.numRuns) * sizeof(RunRecord) +
+                  uint64(m_header.numVertices) * sizeof(VertexRecord) +
+                  uint64(m_header.numIndices) * sizeof(uint32) +
+                  uint64(m_header.numSplines) * sizeof(uint32) +
+                  uint64(m_header.numSplinePoints) * 4 * sizeof(float);
+    if (size != m_mapSize) {
+        return false;
+    }
+
+    // Every record is a multiple of 4 bytes, so the arrays stay aligned
+    data += sizeof(Header);
+    m_materialData = reinterpret_cast<const MaterialRecord *>(data);
+    data += m_header.numMaterials * sizeof(MaterialRecord);
+    m_runData = reinterpret_cast<const RunRecord *>(data);
+    data += m_header.numRuns * sizeof(RunRecord);
+    m_vertexData = reinterpret_cast<const VertexRecord *>(data);
+    data += m_header.numVertices * sizeof(VertexRecord);
+    m_indexData = reinterpret_cast<const uint32 *>(data);
+    data += m_header.numIndices * sizeof(uint32);
+    m_splineLengthData = reinterpret_cast<const uint32 *>(data);
+    data += m_header.numSplines * sizeof(uint32);
+    m_splinePointData = reinterpret_cast<const float *>(data);
+
+    // Check the references, so restore() can trust them
+    for (uint32 r = 0; r < m_header.numRuns; ++r)
+    {
+        const RunRecord &run = m_runData[r];
+        if (run.material >= m_header.numMaterials ||
+            uint64(run.firstVertex) + run.numVertices > m_header.numVertices ||
+            uint64(run.firstIndex) + run.numIndices > m_header.numIndices ||
+            run.numIndices % 3 != 0) {
+            return false;
+        }
+        for (uint32 i = 0; i < run.numIndices; ++i)
+        {
+            if (m_indexData[run.firstIndex + i] >= run.numVertices) {
+                return false;
+            }
+        }
+    }
+    uint64 numPoints = 0;
+    for (uint32 s = 0; s < m_header.numSplines; ++s)
+    {
+        numPoints += m_splineLengthData[s];
+    }
+    return numPoints == m_header.numSplinePoints;
+}
+
+void SceneCache::unmap()
+{
+#ifdef __linux__
+    if (m_map) {
+        ::munmap(m_map, m_mapSize);
+    }
+#endif
+    m_map = NULL;
+    m_mapSize = 0;
+    memset(&m_header, 0, sizeof(m_header));
+}
+
+void SceneCache::restore(Array<shared_ptr<Surface>> &geometry, Table<shared_ptr<Surface>, int> &splineIds,
+                         Array<shared_ptr<Surface>> &preview, Array<Array<Vector4>> &splines) const
+{
+    Array<shared_ptr<UniversalMaterial>> materials;
+    for (uint32 m = 0; m < m_header.numMaterials; ++m)
+    {
+        const MaterialRecord &record = m_materialData[m];
+        const float *l = record.lambertian, *g = record.glossy;
+        const float *t = record.transmissive, *e = record.emissive;
+
+        UniversalMaterial::Specification spec;
+        spec.setLambertian(Texture::Specification(Color4(l[0], l[1], l[2], l[3])));
+        spec.setGlossy(Texture::Specification(Color4(g[0], g[1], g[2], g[3])));
+        spec.setTransmissive(Texture::Specification(Color4(t[0], t[1], t[2], 1.f)));
+        spec.setEmissive(Texture::Specification(Color4(e[0], e[1], e[2], 1.f)));
+        spec.setEta(record.etaTransmit, record.etaReflect);
+        materials.append(UniversalMaterial::create(spec));
+    }
+
+    // One model per spline, so each posed surface is of a known spline,
+    // in the order the splines first appear. The spline bodies get a model
+    // of their own.
+    struct Model
+    {
+        shared_ptr<ArticulatedModel>    model;
+        ArticulatedModel::Part *        part;
+        int                             splineId;
+        bool                            preview;
+    };
+    Array<Model> models;
+    Table<int, int> modelOfSpline;
+    int previewModel = -1;
+
+    for (uint32 r = 0; r < m_header.numRuns; ++r)
+    {
+        const RunRecord &run = m_runData[r];
+        bool preview = (run.flags & PREVIEW) != 0;
+
+        bool created = false;
+        int &index = preview ? previewModel : modelOfSpline.getCreate(run.splineId, created);
+        if (created || index < 0) {
+            index = models.size();
+            Model &m = models.next();
+            m.model = ArticulatedModel::createEmpty(preview ? String("cachedPreview")
+                                                            : format("cachedScene%d", run.splineId));
+            m.part = m.model->addPart("root");
+            m.splineId = run.splineId;
+            m.preview = preview;
+        }
+        Model &model = models[index];
+
+        String name = format("run%u", r);
+        ArticulatedModel::Geometry *geom = model.model->addGeometry(name + "_geom");
+        ArticulatedModel::Mesh *mesh = model.model->addMesh(name + "_mesh", model.part, geom);
+
+        Array<CPUVertexArray::Vertex> &vertexArray = geom->cpuVertexArray.vertex;
+        vertexArray.resize(run.numVertices);
+        for (uint32 i = 0; i < run.numVertices; ++i)
+        {
+            const VertexRecord &record = m_vertexData[run.firstVertex + i];
+            CPUVertexArray::Vertex &v = vertexArray[i];
+            v.position = Vector3(record.position[0], record.position[1], record.position[2]);
+            v.normal = Vector3(record.normal[0], record.normal[1], record.normal[2]);
+            v.tangent = Vector4(record.tangent[0], record.tangent[1], record.tangent[2], record.tangent[3]);
+            v.texCoord0 = Point2(record.texCoord[0], record.texCoord[1]);
+        }
+
+        Array<int> &indexArray = mesh->cpuIndexArray;
+        indexArray.resize(run.numIndices);
+        for (uint32 i = 0; i < run.numIndices; ++i)
+        {
+            indexArray[i] = int(m_indexData[run.firstIndex + i]);
+        }
+
+        mesh->material = materials[run.material];
+        mesh->twoSided = (run.flags & TWO_SIDED) != 0;
+    }
+
+    // The normals and tangents are the cleaned ones already. Merging
+    // vertices would reorder the triangles.
+    ArticulatedModel::CleanGeometrySettings geometrySettings;
+    geometrySettings.allowVertexMerging = false;
+
+    for (int i = 0; i < models.size(); ++i)
+    {
+        models[i].model->cleanGeometry(geometrySettings);
+        if (models[i].preview) {
+            models[i].model->pose(preview, CFrame());
+            continue;
+        }
+
+        Array<shared_ptr<Surface>> posed;
+        models[i].model->pose(posed, CFrame());
+        for (int j = 0; j < posed.size(); ++j)
+        {
+            splineIds.set(posed[j], models[i].splineId);
+        }
+        geometry.append(posed);
+    }
+
+    restoreSplines(splines);
+}
+
+void SceneCache::restoreTris(Array<Tri> &tris, CPUVertexArray &verts,
+                             Table<shared_ptr<Material>, int> &splineIds,
+                             Array<Array<Vector4>> &splines) const
+{
+    verts.hasTangent = true;
+    verts.hasTexCoord0 = true;
+
+    for (uint32 r = 0; r < m_header.numRuns; ++r)
+    {
+        const RunRecord &run = m_runData[r];
+        if (run.flags & PREVIEW) {
+            continue;
+        }
+
+        // Components made from colors rather than Texture::Specifications
+        // don't create textures, so need no GL context
+        const MaterialRecord &record = m_materialData[run.material];
+        const float *l = record.lambertian, *g = record.glossy;
+        const float *t = record.transmissive, *e = record.emissive;
+        shared_ptr<UniversalBSDF> bsdf =
+            UniversalBSDF::create(std::make_shared<Component4>(Color4(l[0], l[1], l[2], l[3])),
+                                  std::make_shared<Component4>(Color4(g[0], g[1], g[2], g[3])),
+                                  std::make_shared<Component3>(Color3(t[0], t[1], t[2])),
+                                  record.etaTransmit, Color3::zero(),
+                                  record.etaReflect, Color3::zero());
+        shared_ptr<UniversalMaterial> material =
+            UniversalMaterial::create(format("run%u", r), bsdf,
+                                      std::make_shared<Component3>(Color3(e[0], e[1], e[2])));
+        splineIds.set(material, run.splineId);
+
+        int first = verts.vertex.size();
+        verts.vertex.resize(first + run.numVertices);
+        for (uint32 i = 0; i < run.numVertices; ++i)
+        {
+            const VertexRecord &record = m_vertexData[run.firstVertex + i];
+            CPUVertexArray::Vertex &v = verts.vertex[first + i];
+            v.position = Vector3(record.position[0], record.position[1], record.position[2]);
+            v.normal = Vector3(record.normal[0], record.normal[1], record.normal[2]);
+            v.tangent = Vector4(record.tangent[0], record.tangent[1], record.tangent[2], record.tangent[3]);
+            v.texCoord0 = Point2(record.texCoord[0], record.texCoord[1]);
+        }
+
+        const uint32 *index = m_indexData + run.firstIndex;
+        for (uint32 i = 0; i + 2 < run.numIndices; i += 3)
+        {
+            tris.append(Tri(first + int(index[i]), first + int(index[i + 1]), first + int(index[i + 2]),
+                            verts, material, 1.0f, (run.flags & TWO_SIDED) != 0));
+        }
+    }
+
+    restoreSplines(splines);
+}
+
+void SceneCache::restoreSplines(Array<Array<Vector4>> &splines) const
+{
+    const float *point = m_splinePointData;
+    for (uint32 s = 0; s < m_header.numSplines; ++s)
+    {
+        Array<Vector4> &spline = splines.next();
+        for (uint32 i = 0; i < m_splineLengthData[s]; ++i, point += 4)
+        {
+            spline.append(Vector4(point[0], point[1], point[2], point[3]));
+        }
+    }
+}
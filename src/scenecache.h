@@ -0,0 +1,160 @@
+#ifndef SCENECACHE_H
+#define SCENECACHE_H
+#include <G3D/G3DAll.h>
+
+/** A binary copy of a loaded scene, so the next load can skip parsing the
+  * models and spline files.
+  *
+  * The cache holds the scene's triangles in world space: the vertices,
+  * runs of triangles with the same material, the constant material
+  * parameters and the spline control points. Each emitting run keeps the
+  * spline it lights, so the emitter list comes out as the parsed one. The
+  * spline bodies World previews are kept apart from the scene's triangles.
+  *
+  * The file is mapped back with mmap and the runs rebuilt as meshes of
+  * ArticulatedModels, one per spline, posed in place. Only scenes whose
+  * materials are constant can be cached; textures would have to be loaded
+  * anyway.
+  *
+  * The file is keyed on the bytes of everything the scene is loaded from,
+  * and on VERSION, so a stale cache is never used.
+  */
+class SceneCache
+{
+public:
+    /** Bump when the layout of the file changes */
+    static const uint32 VERSION = 1;
+
+    SceneCache();
+    ~SceneCache();
+
+    /** FNV-1a hash of VERSION and the contents of the files, in order. A
+      * missing file is hashed by name. */
+    static uint64 key(const Array<String> &files);
+
+    /** The file the cache of the scene at path lives in, in directory */
+    static String filename(const String &directory, const String &path);
+
+    /** Takes the scene from its triangles. splineIds has the spline of
+      * each triangle in tris (-1 for none), and previewTris are the spline
+      * bodies. Returns false if a material is textured or not a
+      * UniversalMaterial. */
+    bool build(const Array<Tri> &tris, const Array<int> &splineIds, const CPUVertexArray &verts,
+               const Array<Tri> &previewTris, const CPUVertexArray &previewVerts,
+               const Array<Array<Vector4>> &splines);
+
+    /** Writes what build() took to a temporary file, then renames it over
+      * path. Returns false if it couldn't. */
+    bool save(const String &path, uint64 key) const;
+
+    /** Maps a file save() wrote. Returns false if there is none, or it is
+      * of another version or key. */
+    bool load(const String &path, uint64 key);
+
+    /** Rebuilds the scene from build() or load(), appending to the
+      * arguments. splineIds receives the spline of each surface appended
+      * to geometry. */
+    void restore(Array<shared_ptr<Surface>> &geometry, Table<shared_ptr<Surface>, int> &splineIds,
+                 Array<shared_ptr<Surface>> &preview, Array<Array<Vector4>> &splines) const;
+
+    /** Rebuilds the scene's triangles alone, without a GL context: there
+      * are no Surfaces, no spline bodies, and the materials hold constants
+      * instead of textures. Appends to the arguments. Each run gets a
+      * material of its own, and splineIds receives the spline of each. */
+    void restoreTris(Array<Tri> &tris, CPUVertexArray &verts,
+                     Table<shared_ptr<Material>, int> &splineIds,
+                     Array<Array<Vector4>> &splines) const;
+
+private:
+    // Copies would unmap the same file twice
+    SceneCache(const SceneCache &) = delete;
+    SceneCache &operator=(const SceneCache &) = delete;
+
+    // The file is a Header, then each array of records in turn. Every
+    // field is 4 bytes except the key, in the writer's byte order.
+
+    struct Header
+    {
+        uint32  magic;
+        uint32  version;
+        uint64  key;
+        uint32  numMaterials;
+        uint32  numRuns;
+        uint32  numVertices;
+        uint32  numIndices;
+        uint32  numSplines;
+        uint32  numSplinePoints;
+    };
+
+    struct MaterialRecord
+    {
+        float   lambertian[4];
+        float   glossy[4];
+        float   transmissive[3];
+        float   emissive[3];
+        float   etaTransmit;
+        float   etaReflect;
+    };
+
+    enum { TWO_SIDED = 1, PREVIEW = 2 };
+
+    /** Consecutive triangles with the same material, sidedness and spline */
+    struct RunRecord
+    {
+        uint32  firstVertex;
+        uint32  numVertices;
+        uint32  firstIndex;     // indices are from firstVertex
+        uint32  numIndices;
+        uint32  material;
+        int32   splineId;
+        uint32  flags;
+    };
+
+    struct VertexRecord
+    {
+        float   position[3];
+        float   normal[3];
+        float   tangent[4];
+        float   texCoord[2];
+    };
+
+    /** Appends the runs of tris, or returns false if one can't be cached */
+    bool addRuns(const Array<Tri> &tris, const Array<int> *splineIds, const CPUVertexArray &verts,
+                 uint32 flags, Table<shared_ptr<Material>, int> &materials);
+
+    /** Index of the record of material, or -1 if it is textured */
+    int addMaterial(const shared_ptr<Material> &material, Table<shared_ptr<Material>, int> &materials);
+
+    /** Appends the splines of the views to splines */
+    void restoreSplines(Array<Array<Vector4>> &splines) const;
+
+    /** Points the views at the records in a mapped file, after checking it */
+    bool point(uint64 key);
+
+    /** Points the views at the arrays build() filled */
+    void pointAtArrays();
+
+    void unmap();
+
+    // What build() takes
+    Array<MaterialRecord>   m_materials;
+    Array<RunRecord>        m_runs;
+    Array<VertexRecord>     m_vertices;
+    Array<uint32>           m_indices;
+    Array<uint32>           m_splineLengths;
+    Array<Vector4>          m_splinePoints;
+
+    // Views of either those or the mapped file
+    Header                  m_header;           // counts of the views
+    const MaterialRecord *  m_materialData;
+    const RunRecord *       m_runData;
+    const VertexRecord *    m_vertexData;
+    const uint32 *          m_indexData;
+    const uint32 *          m_splineLengthData;
+    const float *           m_splinePointData;  // x, y, z, radius
+
+    void *                  m_map;
+    size_t                  m_mapSize;
+};
+
+#endif // SCENECACHE_H
@@ -0,0 +1,96 @@
+#include "splatpass.h"
+
+SplatPass::SplatPass(int width, int height)
+{
+    m_dirLight = Texture::createEmpty("SplatPass::dirLight", width, height, ImageFormat::RGBA16());
+    m_zBuffer = Texture::createEmpty("SplatPass::zBuffer", width, height, ImageFormat::R16());
+    m_dirLight->clear();
+    m_zBuffer->clear();
+
+    m_dirFBO = Framebuffer::create(m_dirLight);
+    m_ZFBO = Framebuffer::create(m_zBuffer);
+    m_dirFBO->set(Framebuffer::AttachmentPoint::COLOR1, m_dirLight);
+    m_ZFBO->set(Framebuffer::AttachmentPoint::COLOR1, m_zBuffer);
+}
+
+void SplatPass::renderDepth(RenderDevice *rd, World &world)
+{
+    rd->pushState(m_ZFBO); {
+        rd->setObjectToWorldMatrix(CFrame());
+        rd->setColorClearValue(Color4::zero());
+        rd->clear();
+        rd->setBlendFunc(RenderDevice::BLEND_ONE, RenderDevice::BLEND_ONE);
+        rd->setProjectionAndCameraMatrix(world.camera()->projection(), world.camera()->frame());
+
+        Args args;
+        args.setPrimitiveType(PrimitiveType::TRIANGLES);
+        Array<shared_ptr<Surface>> geometry = world.geometry();
+        CFrame cframe;
+        for (int i=0; i<geometry.size(); i++)
+        {
+            const shared_ptr<UniversalSurface>& surface = dynamic_pointer_cast<UniversalSurface>(geometry[i]);
+            if (notNull(surface))
+            {
+                surface->getCoordinateFrame(cframe);
+                args.setUniform("MVP", rd->invertYMatrix()*rd->projectionMatrix()*rd->cameraToWorldMatrix().inverse() * cframe);
+                surface->gpuGeom()->setShaderArgs(args);
+                LAUNCH_SHADER("zBuff.*", args);
+            }
+        }
+    } rd->popState();
+
+    // The culler tests the beams against the same depth beamsplat.pix
+    // does. Read back only when the view changes.
+    m_beamCuller.setDepth(m_zBuffer->toImage1());
+}
+
+void SplatPass::splat(RenderDevice *rd, World &world, const Array<SplatVertex> &vertices,
+                      float powerScale, bool cull)
+{
+    rd->pushState(m_dirFBO); {
+        rd->setProjectionAndCameraMatrix(world.camera()->projection(),
+                                         world.camera()->frame());
+
+        rd->setObjectToWorldMatrix(CFrame());
+        rd->setColorClearValue(Color4::zero());
+        rd->clear();
+
+        glEnable(GL_BLEND);
+        rd->setBlendFunc(Framebuffer::COLOR1,
+                         RenderDevice::BLEND_ONE,
+                         RenderDevice::BLEND_ONE,
+                         RenderDevice::BLENDEQ_ADD,
+                         RenderDevice::BLEND_SRC_ALPHA,
+                         RenderDevice::BLEND_DST_ALPHA);
+
+        // Upload to GPU. beamsplat.vrt reads the vertices from the ring by gl_VertexID.
+        if (cull) {
+            Matrix4 viewProjection = rd->projectionMatrix() * rd->cameraToWorldMatrix().inverse().toMatrix4();
+            SplatVertex *visible = m_splatRing.begin(vertices.size());
+            m_splatRing.end(m_beamCuller.cull(vertices, viewProjection,
+                                              world.camera()->frame().lookVector(), visible));
+        } else {
+            m_splatRing.upload(vertices);
+        }
+        m_splatRing.bind(SPLAT_BINDING);
+
+        Args args;
+
+        args.setPrimitiveType(PrimitiveType::LINES);
+        args.setNumIndices(m_splatRing.size());
+        args.setUniform("PowerScale", powerScale);
+        args.setUniform("zDepth", m_ZFBO->texture(1), Sampler::buffer());
+        args.setUniform("Resolution", Vector2(rd->width(), rd->height()));
+        args.setUniform("Look", world.camera()->frame().lookVector());
+        args.setUniform("MVP",
+                        rd->invertYMatrix() *
+                        (rd->projectionMatrix() *
+                         rd->cameraToWorldMatrix().inverse().toMatrix4()));
+
+        if (m_splatRing.size() > 0) {
+            LAUNCH_SHADER("beamsplat.*", args);
+            m_splatRing.fence();
+        }
+
+    } rd->popState();
+}
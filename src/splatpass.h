@@ -0,0 +1,51 @@
+#ifndef SPLATPASS_H
+#define SPLATPASS_H
+#include <G3D/G3DAll.h>
+
+#include "world.h"
+#include "splatvertex.h"
+#include "splatring.h"
+#include "beamculler.h"
+
+/** Splats the direct beams on the GPU, for the app and photon-bench's
+  * check of BeamSplatter.
+  *
+  * renderDepth() renders the depth of the world's geometry with zBuff.*,
+  * and splat() draws the beams with beamsplat.*, additively, depth tested
+  * against it. The beams are streamed through a SplatRing, culled first by
+  * a BeamCuller if asked.
+  */
+class SplatPass
+{
+public:
+    /** Creates the depth and direct light targets, width x height.
+      * Needs a GL context. */
+    SplatPass(int width, int height);
+
+    /** Renders the depth buffer of the world's camera. Call again when the
+      * camera moves. */
+    void renderDepth(RenderDevice *rd, World &world);
+
+    /** Splats the beams (start and end SplatVertex each) into
+      * directLight(), which is cleared first. Each beam's power is scaled
+      * by powerScale. With cull, only the beams the culler keeps are
+      * uploaded. */
+    void splat(RenderDevice *rd, World &world, const Array<SplatVertex> &vertices,
+               float powerScale, bool cull);
+
+    /** The direct light of the last splat() */
+    const shared_ptr<Texture> &directLight() const { return m_dirLight; }
+
+private:
+    /** Shader storage buffer binding of the splat vertices, see beamsplat.vrt */
+    static const int SPLAT_BINDING = 0;
+
+    shared_ptr<Texture>     m_dirLight;
+    shared_ptr<Texture>     m_zBuffer;
+    shared_ptr<Framebuffer> m_dirFBO;
+    shared_ptr<Framebuffer> m_ZFBO;
+    SplatRing               m_splatRing;
+    BeamCuller              m_beamCuller;   // picks the beams m_splatRing gets
+};
+
+#endif // SPLATPASS_H
@@ -0,0 +1,139 @@
+#include "splatring.h"
+
+#include <cstring>
+
+SplatRing::SplatRing()
+    : m_buffer(0),
+      m_mapped(NULL),
+      m_segmentBytes(0),
+      m_segment(0),
+      m_count(0)
+{
+    for (int s = 0; s < NUM_SEGMENTS; ++s)
+        m_fences[s] = 0;
+}
+
+SplatRing::~SplatRing()
+{
+    release();
+}
+
+void SplatRing::allocate(size_t segmentBytes)
+{
+    // Segment offsets must be aligned for glBindBufferRange
+    GLint alignment = 256;
+    glGetIntegerv(GL_SHADER_STORAGE_BUFFER_OFFSET_ALIGNMENT, &alignment);
+    alignment = max(alignment, 1);
+    m_segmentBytes = ((segmentBytes + alignment - 1) / alignment) * alignment;
+    size_t bytes = m_segmentBytes * NUM_SEGMENTS;
+
+    // Bound to the copy target so the vertex and index bindings G3D tracks are left alone
+    glGenBuffers(1, &m_buffer);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    if (GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage) {
+        GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+        glBufferStorage(GL_COPY_WRITE_BUFFER, bytes, NULL, flags);
+        m_mapped = glMapBufferRange(GL_COPY_WRITE_BUFFER, 0, bytes, flags);
+    } else {
+        glBufferData(GL_COPY_WRITE_BUFFER, bytes, NULL, GL_STREAM_DRAW);
+    }
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void SplatRing::release()
+{
+    if (!m_buffer) {
+        return;
+    }
+
+    for (int s = 0; s < NUM_SEGMENTS; ++s)
+        wait(s);
+
+    if (m_mapped) {
+        glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+        glUnmapBuffer(GL_COPY_WRITE_BUFFER);
+        glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+        m_mapped = NULL;
+    }
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+    m_segmentBytes = 0;
+}
+
+void SplatRing::wait(int s)
+{
+    if (!m_fences[s]) {
+        return;
+    }
+
+    GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(m_fences[s], flags, 1000000) == GL_TIMEOUT_EXPIRED) {
+        flags = 0;
+    }
+    glDeleteSync(m_fences[s]);
+    m_fences[s] = 0;
+}
+
+void SplatRing::upload(const Array<SplatVertex> &vertices)
+{
+    SplatVertex *out = begin(vertices.size());
+    if (out) {
+        memcpy(out, vertices.getCArray(), vertices.size() * sizeof(SplatVertex));
+    }
+    end(vertices.size());
+}
+
+SplatVertex *SplatRing::begin(int maxVertices)
+{
+    size_t bytes = maxVertices * sizeof(SplatVertex);
+    m_count = 0;
+    if (bytes == 0) {
+        return NULL;
+    }
+
+    // Grow by half again, so a slowly growing beam count doesn't reallocate every frame
+    if (bytes > m_segmentBytes) {
+        release();
+        allocate(bytes + bytes / 2);
+        m_segment = 0;
+    } else {
+        m_segment = (m_segment + 1) % NUM_SEGMENTS;
+    }
+
+    wait(m_segment);
+    if (m_mapped) {
+        return (SplatVertex*)((uint8*)m_mapped + m_segment * m_segmentBytes);
+    }
+    m_staging.resize(maxVertices, false);
+    return m_staging.getCArray();
+}
+
+void SplatRing::end(int numVertices)
+{
+    m_count = numVertices;
+    if (m_count == 0 || m_mapped) {
+        return;
+    }
+
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_buffer);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, m_segment * m_segmentBytes,
+                    m_count * sizeof(SplatVertex), m_staging.getCArray());
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+
+void SplatRing::bind(int binding) const
+{
+    if (m_count == 0) {
+        return;
+    }
+    glBindBufferRange(GL_SHADER_STORAGE_BUFFER, binding, m_buffer,
+                      m_segment * m_segmentBytes, m_count * sizeof(SplatVertex));
+}
+
+void SplatRing::fence()
+{
+    if (m_count == 0) {
+        return;
+    }
+    m_fences[m_segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
@@ -0,0 +1,74 @@
+#ifndef SPLATRING_H
+#define SPLATRING_H
+#include <G3D/G3DAll.h>
+
+#include "splatvertex.h"
+
+/** Streams the direct beams' splat vertices to the GPU, once per frame.
+  *
+  * One GL buffer is split into NUM_SEGMENTS segments and mapped once, for
+  * good (GL 4.4 persistent, coherent mapping). Each frame's vertices are
+  * copied into the next segment, and a fence after the draw that reads a
+  * segment keeps the CPU from overwriting it before the GPU is done. So a
+  * frame allocates nothing and copies the vertices once. The buffer only
+  * grows when a frame has more beams than a segment holds.
+  *
+  * beamsplat.vrt reads the vertices as a shader storage buffer, by
+  * gl_VertexID, so they need no vertex attribute setup.
+  *
+  * Without GL 4.4, the segments are written with glBufferSubData instead,
+  * from a staging array.
+  */
+class SplatRing
+{
+public:
+    SplatRing();
+    ~SplatRing();
+
+    /** Copies the vertices into the next segment. Waits for the GPU if it
+      * is still reading that segment. */
+    void upload(const Array<SplatVertex> &vertices);
+
+    /** Starts an upload that is written in place, e.g. by BeamCuller:
+      * returns room for maxVertices in the next segment (NULL for none),
+      * to write the vertices to before end(). Waits for the GPU if it is
+      * still reading that segment. */
+    SplatVertex *begin(int maxVertices);
+
+    /** Finishes the upload begin() started, of the first numVertices */
+    void end(int numVertices);
+
+    /** Binds the last upload as shader storage buffer binding */
+    void bind(int binding) const;
+
+    /** Call after the draw that reads the last upload */
+    void fence();
+
+    /** Vertices in the last upload */
+    int size() const { return m_count; }
+
+    /** Whether the buffer is persistently mapped */
+    bool persistent() const { return m_mapped != NULL; }
+
+private:
+    static const int NUM_SEGMENTS = 3;
+
+    /** Creates the buffer with segments of at least segmentBytes */
+    void allocate(size_t segmentBytes);
+
+    /** Waits for the GPU and deletes the buffer */
+    void release();
+
+    /** Waits until the GPU is done with segment s */
+    void wait(int s);
+
+    GLuint  m_buffer;
+    void *  m_mapped;       // the whole buffer, if persistently mapped
+    size_t  m_segmentBytes;
+    int     m_segment;      // segment of the last upload
+    int     m_count;
+    GLsync  m_fences[NUM_SEGMENTS];
+    Array<SplatVertex> m_staging;  // what begin() returns without a mapping
+};
+
+#endif // SPLATRING_H
@@ -0,0 +1,64 @@
+#ifndef SPLATVERTEX_H
+#define SPLATVERTEX_H
+#include <G3D/G3DAll.h>
+
+#include "photonbeamette.h"
+
+/** One end of a direct beam, laid out as beamsplat.vrt reads it.
+  *
+  * Two consecutive vertices, start then end, make one beam (a line for the
+  * geometry shader). The power is the beam's own; gpuProcess() scales it
+  * for the pass with the PowerScale uniform, so the vertices are copied to
+  * the GPU as they are.
+  */
+struct SplatVertex
+{
+    Point3  position;
+    Vector3 major;
+    Vector3 minor;
+    Power3  power;
+
+    /** Appends the start and end vertices of a beam */
+    static void append(Array<SplatVertex> &vertices, const PhotonBeamette &beam)
+    {
+        SplatVertex &start = vertices.next();
+        start.position = beam.m_start;
+        start.major = beam.m_start_major;
+        start.minor = beam.m_start_minor;
+        start.power = beam.m_power;
+
+        SplatVertex &end = vertices.next();
+        end.position = beam.m_end;
+        end.major = beam.m_end_major;
+        end.minor = beam.m_end_minor;
+        end.power = beam.m_power;
+    }
+
+    /** The offsets of a beam's quad corners from its start and end, as
+      * beamsplat.geo computes them: across the beam as seen along look,
+      * as long as the minor axes, and turned so the quad faces the camera */
+    static void perpendiculars(const SplatVertex &start, const SplatVertex &end, const Vector3 &look,
+                               Vector3 &startPerp, Vector3 &endPerp)
+    {
+        Vector3 nlook = look.direction();
+        Vector3 nbeam = (end.position - start.position).direction();
+
+        Vector3 vstart = start.major.direction().cross(start.minor.direction()).direction();
+        Vector3 vend = end.major.direction().cross(end.minor.direction()).direction();
+
+        startPerp = nlook.cross(vstart).direction() * start.minor.length();
+        endPerp = nlook.cross(vend).direction() * end.minor.length();
+
+        if (nlook.cross(startPerp).dot(nbeam) > 0) {
+            startPerp = -startPerp;
+        }
+        if (nlook.cross(endPerp).dot(nbeam) > 0) {
+            endPerp = -endPerp;
+        }
+    }
+};
+
+// beamsplat.vrt indexes the vertices as 12 packed floats
+static_assert(sizeof(SplatVertex) == 12 * sizeof(float), "SplatVertex must be tightly packed");
+
+#endif // SPLATVERTEX_H
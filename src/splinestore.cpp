@@ -0,0 +1,47 @@
+#include "splinestore.h"
+
+SplineStore::SplineStore()
+{
+}
+
+void SplineStore::build(const Array<Array<Vector4>> &splines)
+{
+    clear();
+
+    for (int s = 0; s < splines.size(); ++s)
+    {
+        const Array<Vector4> &spline = splines[s];
+        int n = spline.size();
+
+        m_first.append(m_points.size());
+        m_numPoints.append(n);
+        m_points.append(spline);
+
+        // Extrapolate one point past the end, continuing the last segment
+        if (n > 1) {
+            Vector4 last = spline[n - 1];
+            Vector4 before = spline[n - 2];
+            m_points.append(Vector4(last.xyz() + (last.xyz() - before.xyz()), last.w));
+        } else if (n == 1) {
+            m_points.append(spline[0]);
+        }
+    }
+
+    // Every point but the last extrapolated one starts a segment
+    m_directions.resize(m_points.size());
+    for (int i = 0; i + 1 < m_points.size(); ++i)
+    {
+        m_directions[i] = normalize(m_points[i + 1].xyz() - m_points[i].xyz());
+    }
+    if (m_points.size() > 0) {
+        m_directions.last() = Vector3::zero();
+    }
+}
+
+void SplineStore::clear()
+{
+    m_points.fastClear();
+    m_directions.fastClear();
+    m_first.fastClear();
+    m_numPoints.fastClear();
+}
@@ -0,0 +1,44 @@
+#ifndef SPLINESTORE_H
+#define SPLINESTORE_H
+#include <G3D/G3DAll.h>
+
+/** Read-only, flattened copy of a scene's spline lights for the curve tracer.
+  *
+  * The control points of every spline (x, y, z, radius) are packed into one
+  * array, with the unit direction of each segment precomputed.
+  * Each spline is followed by one extrapolated control point so that the
+  * tracer can look two points ahead from any segment without going out of
+  * bounds.
+  */
+class SplineStore
+{
+public:
+    SplineStore();
+
+    /** Rebuilds the store from a set of splines */
+    void build(const Array<Array<Vector4>> &splines);
+
+    void clear();
+
+    int numSplines() const { return m_first.size(); }
+
+    /** Index of the first control point of a spline */
+    int first(int id) const { return m_first[id]; }
+
+    /** Number of control points in a spline, not counting the extrapolated one */
+    int numPoints(int id) const { return m_numPoints[id]; }
+
+    /** A control point, as x, y, z, radius */
+    const Vector4& point(int i) const { return m_points[i]; }
+
+    /** Unit direction of the segment from control point i to i + 1 */
+    const Vector3& direction(int i) const { return m_directions[i]; }
+
+private:
+    Array<Vector4>  m_points;
+    Array<Vector3>  m_directions;
+    Array<int>      m_first;
+    Array<int>      m_numPoints;
+};
+
+#endif // SPLINESTORE_H
@@ -1,89 +1,257 @@
-
-#include "app.h"
 #include "threadpool.h"
 
-static void wait()
-{
-    // Yield for 10 milliseconds
-    usleep(10000);
-}
+#include <cerrno>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+// CPUs past the last a cpu_set_t holds can't be pinned to
+#ifdef CPU_SETSIZE
+static const long MAX_CPUS = CPU_SETSIZE;
+#else
+static const long MAX_CPUS = 1024;
+#endif
 
-ThreadPoolThread::ThreadPoolThread(App *parent, int index, int numThreads)
+ThreadPoolThread::ThreadPoolThread(ThreadPool *pool, int index, int cpu)
     : Thread("ThreadPoolThread"),
-      m_parent(parent),
+      m_pool(pool),
       m_index(index),
-      m_numThreads(numThreads),
-      m_rendering(false),
-      m_quit(false)
+      m_cpu(cpu)
 { }
 
 ThreadPoolThread::~ThreadPoolThread() { }
 
-bool ThreadPoolThread::isRendering()
+void ThreadPoolThread::threadMain()
+{
+    pin();
+
+    int pass = 0;
+    while (m_pool->waitForPass(pass))
+    {
+        m_pool->work(m_index);
+    }
+}
+
+
+void ThreadPoolThread::pin()
 {
-    return m_rendering;
+    if (m_cpu < 0)
+        return;
+
+    if (m_cpu >= MAX_CPUS) {
+        printf("Not pinning render thread %d, there is no CPU %d\n", m_index, m_cpu);
+        return;
+    }
+
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(m_cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        printf("Could not pin render thread %d to CPU %d\n", m_index, m_cpu);
+#endif
 }
 
-void ThreadPoolThread::trigger()
+
+ThreadPool::ThreadPool(const Callback &callback, int numThreads, const Array<int> &cpus, int tileSize)
+    : m_callback(callback),
+      m_passCallback(&m_callback),
+      m_tileSize(max(1, tileSize)),
+      m_width(0),
+      m_height(0),
+      m_tilesX(0),
+      m_pass(0),
+      m_busy(0),
+      m_quit(false),
+      m_passTime(0.0)
 {
-    m_rendering = true;
+    numThreads = max(1, numThreads);
+    m_busyTime.resize(numThreads);
+    m_idleTime.resize(numThreads);
+
+    for (int i = 0; i < numThreads; ++i)
+    {
+        m_queues.append(shared_ptr<TileQueue>(new TileQueue()));
+        m_busyTime[i] = 0.0;
+        m_idleTime[i] = 0.0;
+    }
+
+    // Pinning is opt in: without cpus, the threads are left to the scheduler
+    for (int i = 0; i < numThreads; ++i)
+    {
+        int cpu = (cpus.size() > 0) ? cpus[i % cpus.size()] : -1;
+        ThreadPoolThread::Ref thr(new ThreadPoolThread(this, i, cpu));
+        m_threads.append(thr);
+        thr->start();
+    }
 }
 
-void ThreadPoolThread::quit()
+ThreadPool::~ThreadPool()
 {
-    m_quit = true;
+    {
+        std::lock_guard<std::mutex> guard(m_lock);
+        m_quit = true;
+    }
+    m_start.notify_all();
+
+    for (int i = 0; i < m_threads.size(); ++i)
+        m_threads[i]->waitForCompletion();
 }
 
-void ThreadPoolThread::threadMain()
+Array<int> ThreadPool::allowedCpus()
 {
-    while (!m_quit)
+    Array<int> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    if (sched_getaffinity(0, sizeof(set), &set) == 0)
     {
-        if (m_rendering)
-        {
-            int w = m_parent->window()->width(),
-                h = m_parent->window()->height();
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set))
+                cpus.append(cpu);
+    }
+#endif
+    return cpus;
+}
 
-            for (int y = m_index; y < h; y += m_numThreads)
-                for (int x = 0; x < w; ++x)
-                    m_parent->traceCallback(x, y);
+bool ThreadPool::parseCpuList(const char *list, Array<int> &cpus)
+{
+    const char *c = list;
+    while (*c)
+    {
+        char *end;
+        errno = 0;
+        long first = strtol(c, &end, 10);
+        if (end == c || errno == ERANGE || first < 0 || first >= MAX_CPUS)
+            return false;
+        long last = first;
+        c = end;
 
-            m_rendering = false;
-        }
-        else
+        if (*c == '-')
         {
-            wait();
+            ++c;
+            errno = 0;
+            last = strtol(c, &end, 10);
+            if (end == c || errno == ERANGE || last < first)
+                return false;
+            c = end;
         }
+
+        // A range may run past the last CPU, e.g. "0-9999" for all of them
+        last = min(last, MAX_CPUS - 1);
+        for (long cpu = first; cpu <= last; ++cpu)
+            cpus.append(int(cpu));
+
+        if (*c == ',')
+            ++c;
+        else if (*c)
+            return false;
     }
+    return cpus.size() > 0;
 }
 
+void ThreadPool::run(int width, int height)
+{
+    run(width, height, m_callback);
+}
 
-ThreadPool::ThreadPool(App *parent, int numThreads)
-    : m_parent(parent)
+void ThreadPool::run(int width, int height, const Callback &callback)
 {
-    for (int i = 0; i < numThreads; ++i)
+    m_width = width;
+    m_height = height;
+    m_tilesX = (m_width + m_tileSize - 1) / m_tileSize;
+    int tilesY = (m_height + m_tileSize - 1) / m_tileSize;
+
+    // Deal the tiles out like cards, so every queue covers the whole screen
+    for (int i = 0; i < m_queues.size(); ++i)
     {
-        ThreadPoolThread::Ref thr(new ThreadPoolThread(parent, i, numThreads));
-        m_threads.append(thr);
-        thr->start();
+        m_queues[i]->tiles.fastClear();
+        m_queues[i]->head = 0;
+    }
+    for (int t = 0; t < m_tilesX * tilesY; ++t)
+    {
+        m_queues[t % m_queues.size()]->tiles.append(t);
     }
+
+    RealTime start = System::time();
+    {
+        std::unique_lock<std::mutex> lock(m_lock);
+        m_passCallback = &callback;
+        m_busy = m_threads.size();
+        ++m_pass;
+        m_start.notify_all();
+
+        m_finished.wait(lock, [this] { return m_busy == 0; });
+    }
+    m_passTime = System::time() - start;
+
+    for (int i = 0; i < m_threads.size(); ++i)
+        m_idleTime[i] = max(0.0, m_passTime - m_busyTime[i]);
 }
 
-ThreadPool::~ThreadPool()
+bool ThreadPool::waitForPass(int &lastPass)
 {
-    for (int i = 0; i < m_threads.size(); ++i)
-        m_threads[i]->quit();
+    std::unique_lock<std::mutex> lock(m_lock);
+    m_start.wait(lock, [this, &lastPass] { return m_quit || m_pass != lastPass; });
 
-    for (int i = 0; i < m_threads.size(); ++i)
-        m_threads[i]->waitForCompletion();
+    lastPass = m_pass;
+    return !m_quit;
 }
 
-void ThreadPool::run()
+void ThreadPool::work(int index)
 {
-    for (int i = 0; i < m_threads.size(); ++i)
-        m_threads[i]->trigger();
+    RealTime start = System::time();
 
-    for (int i = 0; i < m_threads.size(); ++i)
-        while (m_threads[i]->isRendering())
-            wait();
+    int tile;
+    while (nextTile(index, tile))
+        renderTile(tile);
+
+    m_busyTime[index] = System::time() - start;
+
+    std::lock_guard<std::mutex> guard(m_lock);
+    if (--m_busy == 0)
+        m_finished.notify_one();
+}
+
+bool ThreadPool::nextTile(int index, int &tile)
+{
+    // Own queue first, front to back
+    {
+        TileQueue &own = *m_queues[index];
+        std::lock_guard<std::mutex> guard(own.lock);
+        if (own.head < own.tiles.size())
+        {
+            tile = own.tiles[own.head++];
+            return true;
+        }
+    }
+
+    // Then steal from the back of the others, starting with the next thread
+    for (int i = 1; i < m_queues.size(); ++i)
+    {
+        TileQueue &victim = *m_queues[(index + i) % m_queues.size()];
+        std::lock_guard<std::mutex> guard(victim.lock);
+        if (victim.head < victim.tiles.size())
+        {
+            tile = victim.tiles.pop();
+            return true;
+        }
+    }
+
+    return false;
 }
 
+void ThreadPool::renderTile(int tile)
+{
+    int x0 = (tile % m_tilesX) * m_tileSize,
+        y0 = (tile / m_tilesX) * m_tileSize;
+    int x1 = min(x0 + m_tileSize, m_width),
+        y1 = min(y0 + m_tileSize, m_height);
+
+    const Callback &callback = *m_passCallback;
+    for (int y = y0; y < y1; ++y)
+        for (int x = x0; x < x1; ++x)
+            callback(x, y);
+}
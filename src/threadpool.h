@@ -2,8 +2,11 @@
 #define THREADPOOL_H
 
 #include <G3D/G3DAll.h>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
 
-class App;
+class ThreadPool;
 
 /** A worker thread */
 class ThreadPoolThread : public Thread
@@ -11,52 +14,126 @@ class ThreadPoolThread : public Thread
 public:
     typedef shared_ptr<ThreadPoolThread> Ref;
 
-    ThreadPoolThread(App *parent, int index, int numThreads);
+    /** cpu is the CPU to pin the thread to, or -1 to leave it to the scheduler */
+    ThreadPoolThread(ThreadPool *pool, int index, int cpu);
     virtual ~ThreadPoolThread();
 
-    /** Whether this thread is completing a pass */
-    bool isRendering();
-
-    /** Causes this thread to start a new pass */
-    void trigger();
-
-    /** Causes this thread's main loop to return */
-    void quit();
-
 protected:
     /** Entry point */
     void threadMain();
 
 private:
-    App *   m_parent;
-    int     m_index;
-    int     m_numThreads;
-    bool    m_rendering;
-    bool    m_quit;
+    /** Restricts the calling thread to m_cpu */
+    void pin();
+
+    ThreadPool *    m_pool;
+    int             m_index;
+    int             m_cpu;
 };
 
 
-/** Thread pool of threads that call App::threadCallback.
+/** Thread pool of threads that call a per-pixel callback, e.g. App::traceCallback.
+  *
+  * The same set of threads is reused across multiple passes. Previously we
+  * used GThread::runConcurrently2D, but found that after ~200 passes
+  * pthread_create would decide it's out of resources and stop creating new
+  * threads.
+  *
+  * Each pass, the screen is cut into tiles that are dealt out to per-thread
+  * queues. A thread renders the tiles of its own queue from the front, then
+  * steals from the back of the others' until none are left. Idle threads
+  * sleep on a condition variable rather than polling.
   *
-  * More or less mimics GThread::runConcurrently2D with one caveat: the same
-  * set of threads is reused across multiple passes. Previously we used
-  * GThread::runConcurrently2D, but found that after ~200 passes pthread_create
-  * would decide it's out of resources and stop creating new threads. 
+  * Threads can be pinned to CPUs, so each keeps its caches and its pages of
+  * the beam map local. Pinning is opt in: without a CPU list the threads are
+  * left to the scheduler, which keeps them within a taskset of the process.
+  *
+  * With a tile size of 1 and a height of 1, each x of a pass is a task of
+  * its own, which is how the scatter and grid build workers use a pool.
   */
 class ThreadPool
 {
 public:
     typedef shared_ptr<ThreadPool> Ref;
 
-    ThreadPool(App *parent, int numThreads = Thread::numCores());
+    /** Renders pixel (x, y). Called concurrently from all the threads. */
+    typedef std::function<void(int x, int y)> Callback;
+
+    /** Tiles are TILE_SIZE pixels square, unless the pool is given another size */
+    static const int TILE_SIZE = 16;
+
+    /** cpus are the CPUs to pin the threads to, thread i to cpus[i % cpus.size()].
+      * When empty, no thread is pinned. A CPU of -1 leaves its threads to
+      * the scheduler. */
+    ThreadPool(const Callback &callback, int numThreads = Thread::numCores(), const Array<int> &cpus = Array<int>(),
+               int tileSize = TILE_SIZE);
     ~ThreadPool();
 
-    /** Starts a new pass */
-    void run();
+    /** The CPUs the process may run on, empty where affinity isn't supported */
+    static Array<int> allowedCpus();
+
+    /** Parses a CPU list such as "0-7,16,18". Ranges are cut off at the
+      * last CPU affinity can name (CPU_SETSIZE - 1). Returns false if it is
+      * malformed, has a reversed range, or a number out of range. */
+    static bool parseCpuList(const char *list, Array<int> &cpus);
+
+    /** Renders a pass over a width x height image, returns once every pixel is done */
+    void run(int width, int height);
+
+    /** Renders a pass with callback instead of the pool's own, for pools
+      * that run several kinds of work */
+    void run(int width, int height, const Callback &callback);
+
+    int numThreads() const { return m_threads.size(); }
+
+    /** Wall-clock time of the last pass, in seconds */
+    double passTime() const { return m_passTime; }
+
+    /** Time each thread spent without work during the last pass, in seconds */
+    const Array<double>& idleTimes() const { return m_idleTime; }
 
 private:
-    App *                           m_parent;
+    friend class ThreadPoolThread;
+
+    struct TileQueue
+    {
+        std::mutex  lock;
+        Array<int>  tiles;
+        int         head;   // next tile the owner takes; thieves take from the back
+    };
+
+    /** Blocks until a pass newer than lastPass starts. Returns false when the pool is quitting. */
+    bool waitForPass(int &lastPass);
+
+    /** Renders tiles until none are left in any queue */
+    void work(int index);
+
+    /** Takes a tile from a thread's own queue, or failing that, steals one */
+    bool nextTile(int index, int &tile);
+
+    void renderTile(int tile);
+
+    Callback                        m_callback;
+    const Callback *                m_passCallback; // of the pass being run
+    int                             m_tileSize;
     Array<ThreadPoolThread::Ref>    m_threads;
+    Array<shared_ptr<TileQueue>>    m_queues;   // one per thread
+
+    int                             m_width;
+    int                             m_height;
+    int                             m_tilesX;
+
+    // Pass state, guarded by m_lock
+    std::mutex                      m_lock;
+    std::condition_variable         m_start;
+    std::condition_variable         m_finished;
+    int                             m_pass;
+    int                             m_busy;     // threads still working on the pass
+    bool                            m_quit;
+
+    Array<double>                   m_busyTime; // written by each thread for itself
+    Array<double>                   m_idleTime;
+    double                          m_passTime;
 };
 
-#endif
+#endif // THREADPOOL_H
@@ -42,8 +42,10 @@ Radiance3 Utils::exp( float d, const Radiance3 &tau )
   */
 float Utils::cone(float dist, float gatherRadius)
 {
-    static const float volume = pif() * square(gatherRadius) / 3;
-    static const float normalize = 1.f / volume;
+    // The radius shrinks from pass to pass, so the volume does too. It used
+    // to be kept from the first call, which darkened every later pass.
+    float volume = pif() * square(gatherRadius) / 3;
+    float normalize = 1.f / volume;
 
     float height = 1.f - dist / gatherRadius;
     return height * normalize;
@@ -1,5 +1,7 @@
 #include "app.h"
 #include "world.h"
+#include "renderstats.h"
+#include "scenecache.h"
 
 World::World()
     : m_splines(Array<Array<Vector4>>())
@@ -7,6 +9,49 @@ World::World()
 
 World::~World() { }
 
+/** The spline an emitting surface lights, from its name, or -1 for an area
+  * light */
+static int splineId(const shared_ptr<Surface> &surface)
+{
+    std::string name = surface->name().c_str();
+    int id = -1;
+    if (name.find("spline") != std::string::npos) {
+        name = name[0];
+        id = std::atoi(name.c_str());
+    }
+    return id;
+}
+
+/** Whether a triangle's material emits light */
+static bool emitsLight(const Tri &tri)
+{
+    shared_ptr<UniversalMaterial> mtl = dynamic_pointer_cast<UniversalMaterial>(tri.material());
+    return mtl && mtl->emissive().notBlack();
+}
+
+/** The files a scene is loaded from: the scene itself, then the file of each
+  * model an entity uses, and the material library beside an OBJ */
+static Array<String> sceneInputs(const String &path, const Table<String, Any> &models,
+                                 const Table<String, Any> &entities)
+{
+    Array<String> files(path);
+    for (int i = 0; i < (int)entities.size(); ++i)
+    {
+        const Any &e = entities[entities.getKeys()[i]];
+        if (e.name() != "VisibleEntity" && e.name() != "SplineLight")
+            continue;
+
+        const ArticulatedModel::Specification& spec = models[e.table()["model"]];
+        String filename = FileSystem::resolve(spec.filename);
+        files.append(filename);
+
+        String mtl = filename.substr(0, filename.rfind('.')) + ".mtl";
+        if (FileSystem::exists(mtl))
+            files.append(mtl);
+    }
+    return files;
+}
+
 void World::load(const String &path )
 {
 
@@ -28,6 +73,18 @@ void World::load(const String &path )
     debugAssert(scene.containsKey("entities"));
     const Table<String, Any> &entities = scene["entities"].table();
 
+    // Use the scene cache if it is of the same inputs
+    SceneCache cache;
+    String cacheFile;
+    uint64 cacheKey = 0;
+    bool cached = false;
+    if (!m_cacheDirectory.empty())
+    {
+        cacheFile = SceneCache::filename(m_cacheDirectory, path);
+        cacheKey = SceneCache::key(sceneInputs(path, models, entities));
+        cached = cache.load(cacheFile, cacheKey);
+    }
+
     // Parse entities
     printf("%d entities(s)\n", (int)entities.size());
     for (int i = 0; i < (int)entities.size(); ++i)
@@ -49,6 +106,10 @@ void World::load(const String &path )
         {
             printf("ignored (only emitters are used as lights in path)\n");
         }
+        else if ((type == "VisibleEntity" || type == "SplineLight") && cached)
+        {
+            printf("cached\n");
+        }
         else if (type == "VisibleEntity")
         {
             const Table<String, Any> &props = e.table();
@@ -104,48 +165,120 @@ void World::load(const String &path )
         }
     }
 
-    // Build bounding interval hierarchy for scene geometry
+    // The cache keeps which spline each emitter lights, since the surface
+    // names are its own. Without a GL context, as in the batch renderer,
+    // it restores triangles alone, whose materials tell the splines apart.
+    Table<shared_ptr<Surface>, int> cachedIds;
+    Table<shared_ptr<Material>, int> cachedMaterialIds;
+    bool trisOnly = cached && isNull(RenderDevice::current);
     Array<Tri> triArray;
-
-    Surface::getTris(m_geometry, m_verts, triArray);
-    for (int i = 0; i < triArray.size(); ++i)
+    if (trisOnly)
     {
-        triArray[i].material()->setStorage(COPY_TO_CPU);
+        cache.restoreTris(triArray, m_verts, cachedMaterialIds, m_splines);
+        printf("Loaded %s without surfaces\n", cacheFile.c_str());
+    }
+    else if (cached)
+    {
+        cache.restore(m_geometry, cachedIds, m_splineGeometry, m_splines);
+        printf("Loaded %s\n", cacheFile.c_str());
+    }
+    auto emitterId = [&cachedIds, &cachedMaterialIds](const Tri &tri) {
+        shared_ptr<Surface> surface = tri.surface();
+        if (isNull(surface)) {
+            const int *cachedId = cachedMaterialIds.getPointer(tri.material());
+            return cachedId ? *cachedId : -1;
+        }
+        const int *cachedId = cachedIds.getPointer(surface);
+        return cachedId ? *cachedId : splineId(surface);
+    };
 
-        // Check if this triangle emits light
-        shared_ptr<Material> m = triArray[i].material();
-        if (m)
+    // Build bounding interval hierarchy for scene geometry
+    Array<int> triSplineIds;
+    if (!trisOnly)
+    {
+        Surface::getTris(m_geometry, m_verts, triArray);
+        triSplineIds.resize(triArray.size(), false);
+        for (int i = 0; i < triArray.size(); ++i)
         {
-            shared_ptr<UniversalMaterial> mtl =
-                dynamic_pointer_cast<UniversalMaterial>(m);
-
-            if ( mtl->emissive().notBlack() ) {
+            triSplineIds[i] = -1;
+            triArray[i].material()->setStorage(COPY_TO_CPU);
 
-                std::string name = triArray[i].surface()->name().c_str();
-                int id = -1;
-                if (name.find("spline") != std::string::npos) {
-                    name = name[0];
-                    id = std::atoi(name.c_str());
-                }
-                Emitter emitter = Emitter(id, triArray[i]);
-                m_emit.append(emitter);
+            if (emitsLight(triArray[i])) {
+                triSplineIds[i] = emitterId(triArray[i]);
             }
         }
     }
 
+    // Cache what was parsed for the next load
+    if (!cached && !cacheFile.empty())
+    {
+        CPUVertexArray previewVerts;
+        Array<Tri> previewTris;
+        Surface::getTris(m_splineGeometry, previewVerts, previewTris);
+
+        FileSystem::createDirectory(m_cacheDirectory);
+        if (!cache.build(triArray, triSplineIds, m_verts, previewTris, previewVerts, m_splines))
+            printf("Not caching %s, it has textured materials\n", path.c_str());
+        else if (cache.save(cacheFile, cacheKey))
+            printf("Wrote %s\n", cacheFile.c_str());
+        else
+            printf("Could not write %s\n", cacheFile.c_str());
+    }
+
     m_tris.setContents(triArray, m_verts);
+    m_splineStore.build(m_splines);
+
+    // The emitters keep their index in the tree, which is free to order the
+    // triangles its own way, so find them in the tree rather than in triArray
+    for (int i = 0; i < m_tris.size(); ++i)
+    {
+        Tri tri = m_tris[i];
+        if (emitsLight(tri)) {
+            m_emit.append(Emitter(emitterId(tri), tri, i));
+        }
+    }
+
+    // Weight the emitters by how much power they put into the scene
+    Array<float> emitWeights;
+    for (int i = 0; i < m_emit.size(); ++i)
+    {
+        const Tri& tri = m_emit[i].tri();
+
+        shared_ptr<UniversalMaterial> mtl = dynamic_pointer_cast<UniversalMaterial>(tri.material());
+        emitWeights.append(tri.area() * mtl->emissive().mean().average());
+    }
+    m_emitTable.build(emitWeights);
 
     printf( "%d light-emitting triangle(s) in scene.\n", (int) m_emit.size() );
     fflush( stdout );
 }
 
+bool World::isCached(const String &path, const String &directory)
+{
+    if (directory.empty() || !FileSystem::exists(path)) {
+        return false;
+    }
+
+    Any scene;
+    scene.load(path);
+    if (!scene.containsKey("models") || !scene.containsKey("entities")) {
+        return false;
+    }
+
+    SceneCache cache;
+    return cache.load(SceneCache::filename(directory, path),
+                      SceneCache::key(sceneInputs(path, scene["models"].table(), scene["entities"].table())));
+}
+
 void World::unload()
 {
     m_emit.clear();
+    m_emitTable.clear();
     m_geometry.clear();
     m_splineGeometry.clear();
     m_tris.clear();
     m_splines.clear();
+    m_splineStore.clear();
 }
 
 Array<shared_ptr<Surface>> World::geometry()
@@ -162,8 +295,8 @@ shared_ptr<Camera> World::camera()
 
 void World::emissivePoint(Random &random, shared_ptr<Surfel> &surf, float &prob, float &area, int &id)
 {
-    // Pick an emissive triangle uniformly at random
-    int i = random.integer(0, m_emit.size() - 1);
+    // Pick an emissive triangle by power
+    int i = m_emitTable.sample(random);
     const Tri& tri = m_emit[i].tri();
     id = m_emit[i].index();
 
@@ -176,23 +309,17 @@ void World::emissivePoint(Random &random, shared_ptr<Surfel> &surf, float &prob,
           b = (1.f - s) * sqrtT,
           c = s * sqrtT;
 
-    Vector3 point = tri.position(m_verts, 0) * a
-                  + tri.position(m_verts, 1) * b
-                  + tri.position(m_verts, 2) * c;
-
-    Vector3 normal = tri.normal(m_verts, 0) * a
-                   + tri.normal(m_verts, 1) * b
-                   + tri.normal(m_verts, 2) * c;
-    normal = normal.direction();
-
-    // XXX semi-hacky, slow way to get a surfel for this point
-    //     there has to be a better way ...
-    Ray ray(point + normal * 1e-4, -normal);
-    float dist = 0;
-
-    intersect(ray, dist, surf);
+    // Build the surfel straight from the barycentric coordinates,
+    // as if a ray had hit the front of the triangle at that point
+    TriTree::Hit hit;
+    hit.triIndex = m_emit[i].triIndex();
+    hit.u = b;
+    hit.v = c;
+    hit.distance = 0.f;
+    hit.backface = false;
+    m_tris.sample(hit, surf);
 
-    prob = 1.f / m_emit.size() / tri.area();
+    prob = m_emitTable.probability(i) / tri.area();
 
     area = tri.area();
 }
@@ -220,13 +347,14 @@ bool World::emitBeam(Random &random, PhotonBeamette &beam, shared_ptr<Surfel> &s
     // Store the beam information
     beam.m_end = surf->position;
     beam.m_start = light->position;
-    beam.m_power = light->emittedRadiance(dir) * m_emit.size();
+    beam.m_power = light->emittedRadiance(dir) / (prob * area); // divide by the chance of picking this emitter
     beam.m_splineID = id;
     return true;
 }
 
 void World::intersect(const Ray &ray, float &dist, shared_ptr<Surfel> &surf)
 {
+    STATS_COUNT(RAYS_INTERSECT, 1);
     TriTree::Hit hit;
     if (m_tris.intersectRay(ray, hit)) {
         dist = hit.distance;
@@ -234,6 +362,38 @@ void World::intersect(const Ray &ray, float &dist, shared_ptr<Surfel> &surf)
     }
 }
 
+bool World::intersectTriangle(const Ray &ray, float &dist, bool &backface)
+{
+    STATS_COUNT(RAYS_INTERSECT, 1);
+    TriTree::Hit hit;
+    if (!m_tris.intersectRay(ray, hit)) {
+        return false;
+    }
+    dist = hit.distance;
+    backface = hit.backface;
+    return true;
+}
+
+void World::intersectBatch(const Array<Ray> &rays, Array<float> &dist, Array<shared_ptr<Surfel>> &surfs)
+{
+    STATS_COUNT(RAYS_INTERSECT, rays.size());
+    Array<TriTree::Hit> hits;
+    m_tris.intersectRays(rays, hits);
+
+    dist.resize(rays.size());
+    surfs.resize(rays.size());
+    for (int i = 0; i < rays.size(); ++i)
+    {
+        if (hits[i].triIndex != TriTree::Hit::NONE) {
+            dist[i] = hits[i].distance;
+            m_tris.sample(hits[i], surfs[i]);
+        } else {
+            dist[i] = inf();
+            surfs[i] = nullptr;
+        }
+    }
+}
+
 bool World::lineOfSight(const Vector3 &beg, const Vector3 &end)
 {
     Vector3 d = end - beg;
@@ -247,6 +407,7 @@ bool World::lineOfSight(const Vector3 &beg, const Vector3 &end)
     // twoSidedTest -- Don't cull back-facing triangles from intersection test
     // static const bool exitOnAnyHit = true, twoSidedTest = true;
 
+    STATS_COUNT(RAYS_LINE_OF_SIGHT, 1);
     TriTreeBase::Hit hit;
 
     return !m_tris.intersectRay(ray, hit, TriTree::DO_NOT_CULL_BACKFACES | TriTree::OCCLUSION_TEST_ONLY);
@@ -10,6 +10,8 @@
 #include "photonsettings.h"
 #include "photonbeamette.h"
 #include "emitter.h"
+#include "aliastable.h"
+#include "splinestore.h"
 #include "utils.h"
 
 /** Represents a static scene with triangle mesh geometry, multiple lights, and
@@ -22,12 +24,22 @@ public:
     virtual ~World();
 
     /** Loads the geometry, lights and camera from a scene file.
-      * Fails an assert if anything goes wrong.
+      * Fails an assert if anything goes wrong. Without a GL context, only
+      * a cached scene can be loaded, and geometry() is left empty.
       *
       * @param path The file to load (*.scn.any)
       */
     void load(const String &path);
 
+    /** Sets the directory load() caches scenes in, see SceneCache. Scenes
+      * are parsed every time if it is empty, as by default. */
+    void setCacheDirectory(const String &directory) { m_cacheDirectory = directory; }
+
+    /** Whether directory has a current SceneCache of the scene at path.
+      * Such a scene loads without a GL context; others need one for G3D's
+      * model loader. */
+    static bool isCached(const String &path, const String &directory);
+
     /** Clears the contents of this world object
       * Geometry and lights are cleared. The camera is not affected.
       */
@@ -40,12 +52,14 @@ public:
     Array<shared_ptr<Surface>> geometry();
 
     /** Picks a point of light from the scene that emits light from the scene.
-      * The point is picked uniformly at random.
+      * The emitting triangle is picked in proportion to its area times its
+      * emitted power, then the point is picked uniformly on it.
       * @param random   A random number generator
       * @param surf     The surface at the point picked
-      * @param prob     Receives the probability of picking that point out of
-      *                 all light-emitting points in the scene
+      * @param prob     Receives the probability density of picking that point
+      *                 out of all light-emitting points in the scene
       * @param area     The area of the emitter chosen
+      * @param id       The spline the emitter belongs to, -1 for an area light
       */
     void emissivePoint(Random &random, shared_ptr<Surfel> &surf, float &prob, float &area, int &id);
 
@@ -73,6 +87,25 @@ public:
       */
     void intersect(const Ray &ray, float &dist, shared_ptr<Surfel> &surf);
 
+    /** Finds the first triangle a ray intersects, without sampling its surface
+      *
+      * @param ray      The ray to intersect
+      * @param dist     The distance from the ray origin to the triangle
+      * @param backface Whether the ray hit the back of the triangle
+      * @return         False if the ray hits nothing
+      */
+    bool intersectTriangle(const Ray &ray, float &dist, bool &backface);
+
+    /** Finds the first point each ray in a batch intersects with this scene.
+      * The whole batch is handed to the tri tree at once, which is much
+      * friendlier to its caches and SIMD paths than one ray at a time.
+      *
+      * @param rays  The rays to intersect
+      * @param dist  Receives the distance to each hit, inf() for a miss
+      * @param surfs Receives the surface at each hit, null for a miss
+      */
+    void intersectBatch(const Array<Ray> &rays, Array<float> &dist, Array<shared_ptr<Surfel>> &surfs);
+
     /** Determines whether an object occludes the line of sight from beg to end
      *
       * @param beg  The starting point
@@ -115,18 +148,26 @@ public:
     const CFrame& getCameraCframe();
     void setCameraCframe(CFrame& cframe);
 
-    Array<Array<Vector4>> splines(){
+    const Array<Array<Vector4>>& splines() const {
         return m_splines;
     }
 
+    /** Flattened, read-only spline lights for the curve tracer. Built by load(). */
+    const SplineStore& splineStore() const {
+        return m_splineStore;
+    }
+
 private:
     shared_ptr<Camera>  m_camera;   // The scene's camera
     Array<Emitter> m_emit;  // Triangles that emit light
+    AliasTable     m_emitTable; // Picks from m_emit by area * emitted power
     CPUVertexArray      m_verts;    // The scene's vertices
     Array<shared_ptr<Surface>> m_geometry;
     Array<shared_ptr<Surface>> m_splineGeometry; // for previewing purposes
     shared_ptr<PhotonSettings> m_PSettings; // Settings from UI
     Array<Array<Vector4>> m_splines; // collection of spline lights, each light represented by x, y, z, radius
+    SplineStore m_splineStore; // m_splines, flattened for the tracer
+    String m_cacheDirectory; // where load() caches scenes, empty for none
 };
 
 #endif